@@ -0,0 +1,104 @@
+#ifndef CACHE_UTILS
+#define CACHE_UTILS
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// std::hash isn't guaranteed to be stable between runs/builds,
+// so use FNV-1a for everything that ends up as a file name
+class fnv1a
+{
+public:
+    void update(std::span<const std::byte> data)
+    {
+        for(auto b : data)
+        {
+            state ^= static_cast<std::uint64_t>(b);
+            state *= 0x100000001b3ULL;
+        }
+    }
+    void update(std::string_view str)
+    {
+        update(std::as_bytes(std::span(str.data(), str.size())));
+        // separator, so that ("ab","c") and ("a","bc") hash differently
+        update_value(std::uint8_t{0xff});
+    }
+    template<typename T>
+    void update_value(T value)
+    {
+        update(std::as_bytes(std::span(&value, 1)));
+    }
+
+    auto digest() const -> std::uint64_t
+    {
+        return state;
+    }
+private:
+    std::uint64_t state = 0xcbf29ce484222325ULL;
+};
+
+// $XDG_CACHE_HOME/vkcmbench, ~/.cache/vkcmbench or ./.vkcmbench_cache (in that order)
+inline std::filesystem::path default_cache_directory()
+{
+    if(const char* xdg_cache = std::getenv("XDG_CACHE_HOME"); xdg_cache && *xdg_cache)
+    {
+        return std::filesystem::path(xdg_cache) / "vkcmbench";
+    }
+    if(const char* home = std::getenv("HOME"); home && *home)
+    {
+        return std::filesystem::path(home) / ".cache" / "vkcmbench";
+    }
+    return ".vkcmbench_cache";
+}
+
+inline std::optional<std::vector<std::byte>> read_binary_file(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if(!file)
+    {
+        return std::nullopt;
+    }
+    auto size = static_cast<std::size_t>(file.tellg());
+    std::vector<std::byte> data(size);
+    file.seekg(0);
+    if(!file.read(reinterpret_cast<char*>(data.data()), size))
+    {
+        return std::nullopt;
+    }
+    return data;
+}
+
+// Write to a temporary file first and rename it, so that concurrent runs
+// (or a run that gets killed) never leave a half written file behind
+inline bool write_binary_file_atomically(const std::filesystem::path& path, std::span<const std::byte> data)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    auto temporary_path = path;
+    temporary_path += ".tmp" + std::to_string(std::random_device{}());
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        if(!file)
+        {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        if(!file)
+        {
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary_path, path, ec);
+    return !ec;
+}
+
+#endif /* ifndef CACHE_UTILS */
@@ -0,0 +1,54 @@
+# Writes OUTPUT, a .cpp with the files in TEMPLATES (comma separated, semicolons don't
+# survive add_custom_command everywhere) as byte arrays, found by file name through
+# find_embedded_template(). Run with cmake -P
+string(REPLACE "," ";" templates "${TEMPLATES}")
+list(LENGTH templates template_count)
+
+set(arrays "")
+set(entries "")
+set(index 0)
+foreach(path IN LISTS templates)
+    get_filename_component(name "${path}" NAME)
+    file(READ "${path}" hex HEX)
+    file(SIZE "${path}" size)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    string(REGEX REPLACE "((0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],)(0x[0-9a-f][0-9a-f],))"
+           "\\1\n            " bytes "${bytes}")
+    # The trailing 0 keeps empty files from being empty arrays, it isn't part of the size
+    string(APPEND arrays
+        "    constexpr unsigned char template_${index}[] =\n"
+        "    {\n"
+        "            ${bytes}0x00\n"
+        "    };\n")
+    string(APPEND entries
+        "        {\"${name}\", std::string_view(reinterpret_cast<const char*>(template_${index}), ${size})},\n")
+    math(EXPR index "${index} + 1")
+endforeach()
+
+file(WRITE "${OUTPUT}"
+"// Generated by cmake/embed_templates.cmake, don't edit
+#include \"embedded_templates.hpp\"
+
+#include <array>
+#include <utility>
+
+namespace
+{
+${arrays}
+    const std::array<std::pair<std::string_view, std::string_view>, ${template_count}> templates
+    {{
+${entries}    }};
+}
+
+std::optional<std::string_view> find_embedded_template(std::string_view name)
+{
+    for(const auto& [template_name, code] : templates)
+    {
+        if(template_name == name)
+        {
+            return code;
+        }
+    }
+    return std::nullopt;
+}
+")
@@ -1,5 +1,19 @@
+#include "coopmat_autotuner.hpp"
+#include "coopmat_bandwidth_benchmark.hpp"
 #include "coopmat_benchmark.hpp"
 #include "coopmat_benchmark_shader.hpp"
+#include "coopmat_gemm_benchmark.hpp"
+#include "coopmat_transfer_benchmark.hpp"
+#include "cache_utils.hpp"
+#include "device_context.hpp"
+#include "embedded_templates.hpp"
+#include "parallel_for.hpp"
+#include "pipeline_cache.hpp"
+#include "precompiled_spirv.hpp"
+#include "result_writer.hpp"
+#include "shaderc_loader.hpp"
+#include "spirv_cache.hpp"
+#include "sweep_spec.hpp"
 #include "vk_component_type_to_str.hpp"
 
 #include <fmt/core.h>
@@ -8,14 +22,30 @@
 
 #include <boost/container_hash/hash.hpp>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <barrier>
+#include <bit>
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <filesystem>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <stdfloat>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
@@ -65,8 +95,338 @@ std::string driver_version_to_str(
     }
 }
 
-int main()
+void print_usage(std::string_view program_name)
 {
+    fmt::print("Usage: {} [options]\n", program_name);
+    fmt::print("  --sweep <path>          read a JSON sweep file, options after it override what it sets\n");
+    fmt::print("  --template-dir <dir>    read the *.comp.glsl.in templates from here instead of the built-in ones\n");
+    fmt::print("  --devices <l>           only use these devices, by index or part of the name\n");
+    fmt::print("  --shapes <MxNxK,...>    only benchmark these tile shapes\n");
+    fmt::print("  --types <A/B/C/D,...>   only benchmark these type combinations, '*' matches any type\n");
+    fmt::print("  --blocks-in-kernel <l>  sweep these values instead of the tuned one, e.g. 1,2,4 or 1..32*2 or 8..64+8\n");
+    fmt::print("  --insts-in-block <l>    same for insts_in_block\n");
+    fmt::print("  --num-groups <l>        same for num_groups\n");
+    fmt::print("  --inner-iterations <l>  loop count(s) inside the kernel (default: 256)\n");
+    fmt::print("  --workgroup-subgroups <l> subgroups per workgroup of the mma kernel, e.g. 1,2,4,8 (default: 1)\n");
+    fmt::print("  --repetitions <n>       dispatches per measurement batch (default: 10)\n");
+    fmt::print("  --autotune              search blocks_in_kernel/insts_in_block/num_groups per configuration\n");
+    fmt::print("  --tuning-file <path>    where tuned configurations are loaded from/stored to (default: coopmat_tuning.txt)\n");
+    fmt::print("  --tuning-margin <frac>  stop searching in a direction once a step gains less than this (default: 0.02)\n");
+    fmt::print("  --spirv-cache <dir>     where compiled SPIR-V is cached (default: {})\n",
+            (default_cache_directory() / "spirv").string());
+    fmt::print("  --no-spirv-cache        always compile GLSL->SPIR-V\n");
+    fmt::print("  --pipeline-cache <dir>  where VkPipelineCache data is kept between runs (default: {})\n",
+            (default_cache_directory() / "pipeline").string());
+    fmt::print("  --no-pipeline-cache     create pipelines without a VkPipelineCache\n");
+    fmt::print("  --ci-tolerance <frac>   repeat until the CI of the median is within +- this (default: 0, fixed repetitions)\n");
+    fmt::print("  --time-budget <sec>     per benchmark limit for --ci-tolerance (default: 10)\n");
+    fmt::print("  --max-repetitions <n>   per benchmark limit for --ci-tolerance (default: 10000)\n");
+    fmt::print("  --outlier-threshold <x> reject samples more than x MAD-sigmas from the median, 0 disables (default: 3.5)\n");
+    fmt::print("  --warmup-max <n>        max. untimed warm-up dispatches, 0 disables warm-up (default: 128)\n");
+    fmt::print("  --warmup-threshold <f>  warm-up ends once successive batch medians are within this (default: 0.02)\n");
+    fmt::print("  --parallel-devices      benchmark all devices at the same time, one host thread each\n");
+    fmt::print("  --lockstep              with --parallel-devices, start the n-th benchmark on all devices together\n");
+    fmt::print("  --queues-per-family <n> request up to n queues from every compute capable family (default: 1)\n");
+    fmt::print("  --multi-queue           after each benchmark, run it on all queues at once\n");
+    fmt::print("  --multi-queue-rounds <n> timed rounds on all queues after an untimed one (default: 10)\n");
+    fmt::print("  --latency               after each mma benchmark, measure dispatch/submit latency with params.n = 0\n");
+    fmt::print("  --latency-samples <n>   dispatches per latency measurement (default: 1000)\n");
+    fmt::print("  --scaling               after each mma benchmark, sweep num_groups to find where throughput saturates\n");
+    fmt::print("  --scaling-fraction <f>  fraction of the peak that counts as saturated (default: 0.95)\n");
+    fmt::print("  --phases                also run cut-down mma kernels to split the time into launch/load/store/mma\n");
+    fmt::print("  --gemm <MxNxK,...>      also run tiled GEMMs of these sizes and compare them to the peak\n");
+    fmt::print("  --bandwidth             also measure coopMatLoad/coopMatStore bandwidth\n");
+    fmt::print("  --bandwidth-sizes <l>   comma separated working set sizes, K/M/G suffixes allowed (default: 16K,256K,4M,64M,512M)\n");
+    fmt::print("  --transfer              also time host<->device copies and copy/compute overlap on a transfer queue\n");
+    fmt::print("  --transfer-sizes <l>    comma separated copy sizes, K/M/G suffixes allowed (default: 4K,64K,1M,16M,256M)\n");
+    fmt::print("  --push-addresses        pass the buffer addresses as push constants instead of through a descriptor set\n");
+    fmt::print("  --validate              check the mma results against a host reference after each benchmark\n");
+    fmt::print("  --output <path>         append one result record per benchmark to this file\n");
+    fmt::print("  --format <jsonl|csv>    format of --output (default: csv for *.csv, jsonl otherwise)\n");
+}
+
+int main(int argc, char* argv[])
+{
+    bool autotune = false;
+    std::filesystem::path tuning_file = "coopmat_tuning.txt";
+    double tuning_margin = 0.02;
+    std::filesystem::path spirv_cache_directory = default_cache_directory() / "spirv";
+    bool use_spirv_cache = true;
+    std::filesystem::path pipeline_cache_directory = default_cache_directory() / "pipeline";
+    bool use_pipeline_cache = true;
+    std::filesystem::path output_file;
+    std::optional<result_format> output_format;
+    measurement_settings measurement;
+    bool parallel_devices = false;
+    bool lockstep = false;
+    std::uint32_t queues_per_family = 1;
+    std::size_t latency_samples = 1000;
+    std::size_t multi_queue_rounds = 10;
+    double scaling_fraction = 0.95;
+    address_binding binding = address_binding::descriptor;
+    sweep_spec spec;
+
+    // Malformed numbers and lists (here or in a sweep file) end up in the catch
+    try
+    {
+        for(int i = 1; i < argc; i++)
+        {
+            std::string_view arg(argv[i]);
+            auto next_arg = [&]() -> std::string
+            {
+                if(i+1 >= argc)
+                {
+                    fmt::print("Missing value for {}\n", arg);
+                    print_usage(argv[0]);
+                    std::exit(-1);
+                }
+                return argv[++i];
+            };
+
+            if(arg == "--sweep")
+            {
+                load_sweep_spec(next_arg(), spec);
+            }
+            else if(arg == "--template-dir")
+            {
+                spec.template_directory = next_arg();
+            }
+            else if(arg == "--devices")
+            {
+                spec.devices.clear();
+                std::stringstream list_stream(next_arg());
+                std::string device_str;
+                while(std::getline(list_stream, device_str, ','))
+                {
+                    spec.devices.push_back(device_str);
+                }
+            }
+            else if(arg == "--shapes")
+            {
+                spec.shapes = parse_shapes(next_arg());
+            }
+            else if(arg == "--types")
+            {
+                spec.types.clear();
+                std::stringstream list_stream(next_arg());
+                std::string types_str;
+                while(std::getline(list_stream, types_str, ','))
+                {
+                    spec.types.push_back(types_str);
+                }
+            }
+            else if(arg == "--blocks-in-kernel")
+            {
+                spec.blocks_in_kernel = parse_uint_list(next_arg());
+            }
+            else if(arg == "--insts-in-block")
+            {
+                spec.insts_in_block = parse_uint_list(next_arg());
+            }
+            else if(arg == "--num-groups")
+            {
+                spec.num_groups = parse_uint_list(next_arg());
+            }
+            else if(arg == "--workgroup-subgroups")
+            {
+                auto values = parse_uint_list(next_arg());
+                if(!values.empty())
+                {
+                    spec.workgroup_subgroups = values;
+                }
+            }
+            else if(arg == "--inner-iterations")
+            {
+                auto values = parse_uint_list(next_arg());
+                if(!values.empty())
+                {
+                    spec.inner_iterations = values;
+                }
+            }
+            else if(arg == "--repetitions")
+            {
+                spec.repetitions = std::max(1u, parse_uint32(next_arg()));
+            }
+            else if(arg == "--autotune")
+            {
+                autotune = true;
+            }
+            else if(arg == "--tuning-file")
+            {
+                tuning_file = next_arg();
+            }
+            else if(arg == "--tuning-margin")
+            {
+                tuning_margin = std::stod(next_arg());
+            }
+            else if(arg == "--spirv-cache")
+            {
+                spirv_cache_directory = next_arg();
+            }
+            else if(arg == "--no-spirv-cache")
+            {
+                use_spirv_cache = false;
+            }
+            else if(arg == "--pipeline-cache")
+            {
+                pipeline_cache_directory = next_arg();
+            }
+            else if(arg == "--no-pipeline-cache")
+            {
+                use_pipeline_cache = false;
+            }
+            else if(arg == "--ci-tolerance")
+            {
+                measurement.ci_tolerance = std::stod(next_arg());
+            }
+            else if(arg == "--time-budget")
+            {
+                measurement.time_budget_seconds = std::stod(next_arg());
+            }
+            else if(arg == "--max-repetitions")
+            {
+                measurement.max_repetitions = parse_uint32(next_arg());
+            }
+            else if(arg == "--outlier-threshold")
+            {
+                measurement.statistics.outlier_threshold = std::stod(next_arg());
+            }
+            else if(arg == "--warmup-max")
+            {
+                measurement.max_warmup_iterations = parse_uint32(next_arg());
+            }
+            else if(arg == "--warmup-threshold")
+            {
+                measurement.warmup_threshold = std::stod(next_arg());
+            }
+            else if(arg == "--parallel-devices")
+            {
+                parallel_devices = true;
+            }
+            else if(arg == "--lockstep")
+            {
+                lockstep = true;
+            }
+            else if(arg == "--queues-per-family")
+            {
+                queues_per_family = std::max(1u, parse_uint32(next_arg()));
+            }
+            else if(arg == "--multi-queue")
+            {
+                spec.modes.insert(sweep_mode::multi_queue);
+            }
+            else if(arg == "--multi-queue-rounds")
+            {
+                multi_queue_rounds = std::max(1u, parse_uint32(next_arg()));
+            }
+            else if(arg == "--latency")
+            {
+                spec.modes.insert(sweep_mode::latency);
+            }
+            else if(arg == "--latency-samples")
+            {
+                latency_samples = std::max(2u, parse_uint32(next_arg()));
+            }
+            else if(arg == "--scaling")
+            {
+                spec.modes.insert(sweep_mode::scaling);
+            }
+            else if(arg == "--scaling-fraction")
+            {
+                scaling_fraction = std::stod(next_arg());
+            }
+            else if(arg == "--phases")
+            {
+                spec.modes.insert(sweep_mode::phases);
+            }
+            else if(arg == "--gemm")
+            {
+                spec.gemm_sizes.clear();
+                for(auto shape : parse_shapes(next_arg()))
+                {
+                    spec.gemm_sizes.push_back(gemm_size{shape.m, shape.n, shape.k});
+                }
+            }
+            else if(arg == "--push-addresses")
+            {
+                binding = address_binding::push_constant;
+            }
+            else if(arg == "--validate")
+            {
+                spec.modes.insert(sweep_mode::validate);
+            }
+            else if(arg == "--bandwidth")
+            {
+                spec.modes.insert(sweep_mode::bandwidth);
+            }
+            else if(arg == "--bandwidth-sizes")
+            {
+                spec.bandwidth_sizes = parse_byte_sizes(next_arg());
+            }
+            else if(arg == "--transfer")
+            {
+                spec.modes.insert(sweep_mode::transfer);
+            }
+            else if(arg == "--transfer-sizes")
+            {
+                spec.transfer_sizes = parse_byte_sizes(next_arg());
+            }
+            else if(arg == "--output")
+            {
+                output_file = next_arg();
+            }
+            else if(arg == "--format")
+            {
+                auto name = next_arg();
+                result_format format;
+                if(!result_writer::parse_format(name, format))
+                {
+                    fmt::print("Unknown output format: {}\n", name);
+                    print_usage(argv[0]);
+                    return -1;
+                }
+                output_format = format;
+            }
+            else
+            {
+                fmt::print("Unknown argument: {}\n", arg);
+                print_usage(argv[0]);
+                return -1;
+            }
+        }
+    }
+    catch(const std::exception& e)
+    {
+        fmt::print("Invalid arguments: {}\n", e.what());
+        print_usage(argv[0]);
+        return -1;
+    }
+
+    const bool multi_queue = spec.has_mode(sweep_mode::multi_queue);
+    const bool latency = spec.has_mode(sweep_mode::latency);
+    const bool scaling = spec.has_mode(sweep_mode::scaling);
+    const bool phases = spec.has_mode(sweep_mode::phases);
+    const bool validate = spec.has_mode(sweep_mode::validate);
+    const bool bandwidth = spec.has_mode(sweep_mode::bandwidth);
+    const bool transfer = spec.has_mode(sweep_mode::transfer);
+    const auto& gemm_sizes = spec.gemm_sizes;
+
+    tuning_database tunings;
+    tunings.load(tuning_file);
+
+    std::unique_ptr<spirv_cache> shader_cache;
+    if(use_spirv_cache)
+    {
+        shader_cache = std::make_unique<spirv_cache>(spirv_cache_directory);
+    }
+
+    std::unique_ptr<result_writer> results;
+    if(!output_file.empty())
+    {
+        results = std::make_unique<result_writer>(output_file,
+                output_format.value_or(result_writer::format_from_path(output_file)));
+    }
+
     // Depending on the implementation, you might need to get all functions with
     // vkGetInstanceProcAddr(). This can also include vkGetInstanceProcAddr (Yes,
     // it's weird) and global commands that should work without an instance
@@ -218,12 +578,43 @@ int main()
 
     std::vector<VkDevice> devices;
 
-    std::array<float,1> queue_priorities{{1.0f}};
+    std::vector<float> queue_priorities(queues_per_family, 1.0f);
 
 
-    std::vector<std::unique_ptr<base_coopmat_benchmark>> benchmarks;
+    struct benchmark_job
+    {
+        std::unique_ptr<base_coopmat_benchmark> benchmark;
+        std::string kernel;
+        tuning_parameters tuning;
+        std::string tuning_key;
+        std::string device_name;
+        std::string driver_version;
+        std::uint32_t subgroup_size;
+        std::size_t shader_variant;
+        // The mma job whose throughput this one is compared against
+        std::optional<std::size_t> reference_job = std::nullopt;
+        // The mma job this is a cut-down version of, for the phase breakdown
+        std::optional<std::size_t> phase_of = std::nullopt;
+        // Loop count inside the kernel, the sweep can have several
+        std::uint32_t inner_iterations = 0;
+        // The mma job with the first workgroup size of the same sweep point
+        std::optional<std::size_t> workgroup_sweep_of = std::nullopt;
+    };
+    std::vector<benchmark_job> benchmarks;
 
-    using dpkey = std::pair<VkDevice,VkCooperativeMatrixPropertiesKHR>;
+    // Everything needed to compile a shader, compilation happens after all devices were enumerated
+    struct shader_variant
+    {
+        VkDevice device;
+        std::string_view code_template;
+        coopmat_benchmark_shader::macro_list macros;
+        std::uint32_t subgroup_size;
+        std::shared_ptr<coopmat_benchmark_shader> shader;
+    };
+    std::vector<shader_variant> shader_variants;
+
+    // Different tunings need different shaders, so they are part of the key
+    using dpkey = std::tuple<VkDevice,VkCooperativeMatrixPropertiesKHR,std::uint32_t,std::uint32_t,std::uint32_t>;
 
     auto cm_hash = [](dpkey dev_prop) -> std::size_t
     {
@@ -232,6 +623,12 @@ int main()
         boost::hash_combine(hash, std::get<1>(dev_prop).AType);
         boost::hash_combine(hash, std::get<1>(dev_prop).BType);
         boost::hash_combine(hash, std::get<1>(dev_prop).CType);
+        boost::hash_combine(hash, std::get<1>(dev_prop).ResultType);
+        boost::hash_combine(hash, std::get<1>(dev_prop).saturatingAccumulation);
+        boost::hash_combine(hash, std::get<1>(dev_prop).scope);
+        boost::hash_combine(hash, std::get<2>(dev_prop));
+        boost::hash_combine(hash, std::get<3>(dev_prop));
+        boost::hash_combine(hash, std::get<4>(dev_prop));
 
         return hash;
     };
@@ -241,49 +638,106 @@ int main()
         return (std::get<1>(dev_prop1).AType == std::get<1>(dev_prop2).AType) &&
                (std::get<1>(dev_prop1).BType == std::get<1>(dev_prop2).BType) &&
                (std::get<1>(dev_prop1).CType == std::get<1>(dev_prop2).CType) &&
+               (std::get<1>(dev_prop1).ResultType == std::get<1>(dev_prop2).ResultType) &&
+               (std::get<1>(dev_prop1).saturatingAccumulation == std::get<1>(dev_prop2).saturatingAccumulation) &&
+               (std::get<1>(dev_prop1).scope == std::get<1>(dev_prop2).scope) &&
+               (std::get<2>(dev_prop1) == std::get<2>(dev_prop2)) &&
+               (std::get<3>(dev_prop1) == std::get<3>(dev_prop2)) &&
+               (std::get<4>(dev_prop1) == std::get<4>(dev_prop2)) &&
                (std::get<0>(dev_prop1) == std::get<0>(dev_prop2));
     };
     // TODO: better way of storing this
     std::unordered_map<
         dpkey,
-        std::shared_ptr<coopmat_benchmark_shader>,
+        std::size_t,
         decltype(cm_hash),
         decltype(cm_equal)> shaders(10, cm_hash, cm_equal);
 
 
-    // These numbers go to ~ 95% FLOPS on GH200 (of what you can do with Vulkan - which is somewhat 
-    // en par with MMA/WMMA CUDA, but falls short of what you can get with WGMMA).
-    // You can get a bit more by making them bigger and can make them somewhat smaller and still get > 90%
+    // default_tuning lives in coopmat_benchmark.hpp, coopmat_precompile needs it too
 
-    // Determining the optimum for these numbers is a good idea for an auto-tuner
-    constexpr std::uint32_t blocks_in_kernel = 4;
-    constexpr std::uint32_t insts_in_block = 8;
-    // Not sure what to base this number on, I guess it should be something like
-    // number_of_compute_units*warps_per_sm, but vulkan doesn't expose functionality
-    // to get those numbers
-    constexpr std::uint32_t num_groups = 132*8;
-
-    // loop size inside the kernel
-    constexpr std::uint32_t inner_iterations = 256;
+    // loop size inside the kernel (the first one of the sweep for the things that only take one)
+    const std::uint32_t inner_iterations = spec.inner_iterations.front();
 
     // number of measurements to take
-    constexpr std::uint32_t num_repetitions = 10;
+    const std::uint32_t num_repetitions = spec.repetitions;
+
+    // 2x2 subgroups per workgroup with 2x2 tiles each, 2 tiles deep in K per shared memory step
+    constexpr gemm_tiling default_gemm_tiling
+    {
+        .wg_subgroups_m = 2,
+        .wg_subgroups_n = 2,
+        .sg_tiles_m = 2,
+        .sg_tiles_n = 2,
+        .bk_tiles = 2,
+    };
+
+    // tiles each subgroup loads/stores per loop iteration in the bandwidth kernels
+    constexpr std::uint32_t bandwidth_tiles_per_iteration = 4;
+
+    // same inputs every run, so a failure can be reproduced
+    constexpr std::uint64_t validation_seed = 0xc0ffee;
+
 
+    // The templates built into the binary, unless --template-dir says otherwise
+    auto read_template = [&spec](std::string_view name)
+    {
+        if(!spec.template_directory)
+        {
+            auto embedded = find_embedded_template(name);
+            if(!embedded)
+            {
+                throw std::runtime_error(fmt::format("No shader template {} in this build", name));
+            }
+            return std::string(*embedded);
+        }
+        auto path = *spec.template_directory / name;
+        std::ifstream template_stream(path);
+        if(!template_stream)
+        {
+            throw std::runtime_error(fmt::format("Failed to open shader template {}", path.string()));
+        }
+        std::stringstream code_stream;
+        code_stream << template_stream.rdbuf();
+        return code_stream.str();
+    };
+
+    std::string code_str = read_template("coopmat.comp.glsl.in");
+
+    std::string gemm_code_str;
+    if(!gemm_sizes.empty())
+    {
+        gemm_code_str = read_template("coopmat_gemm.comp.glsl.in");
+    }
 
-    std::ifstream spv_template_stream("coopmat.comp.glsl.in");
-    std::string code_str;
-    std::stringstream code_stream;
+    std::string bandwidth_code_str;
+    if(bandwidth)
+    {
+        bandwidth_code_str = read_template("coopmat_bandwidth.comp.glsl.in");
+    }
 
-    code_stream << spv_template_stream.rdbuf();
-    code_str = code_stream.str();
+    // Points of the blocks x insts x groups x iterations sweep, and the ones that made no sense
+    std::size_t sweep_points = 0;
+    std::size_t dropped_sweep_points = 0;
+    // Overlapping lists and rounding num_groups to whole workgroups can produce the same job twice,
+    // only the first one is run. Device, tuning key (sizes, types, saturation), scope and the sweep values
+    std::set<std::tuple<VkDevice, std::string, VkScopeKHR, std::uint32_t, std::uint32_t, std::uint32_t,
+                        std::uint32_t, std::uint32_t>> job_keys;
+    std::size_t duplicate_sweep_points = 0;
 
-    // TODO: I think I need to make a per-device abstraction of some kind to store this kind of data
-    std::unordered_map<VkDevice, coopmat_benchmark_shader::configuration> device_shader_configs;
-    std::unordered_map<VkDevice, std::vector<VkDeviceQueueCreateInfo>> device_dqcis;
+    std::unordered_map<VkDevice, std::unique_ptr<device_context>> device_contexts;
     for(auto pd_idx : pd_to_use)
     {
         auto phy_dev = physical_devices[pd_idx];
 
+        VkPhysicalDeviceProperties filter_properties;
+        vkGetPhysicalDeviceProperties(phy_dev, &filter_properties);
+        if(!spec.matches_device(pd_idx, filter_properties.deviceName))
+        {
+            fmt::print("Skipping physical device {} ({}): not in --devices\n", pd_idx, filter_properties.deviceName);
+            continue;
+        }
+
 
 
         std::vector<VkQueueFamilyProperties2> qfps;
@@ -303,17 +757,88 @@ int main()
             if (qfp.queueFamilyProperties.queueFlags & VK_QUEUE_COMPUTE_BIT)
             {
                 dqci.queueFamilyIndex = i;
-                dqci.queueCount = 1;
+                dqci.queueCount = std::min(queues_per_family, qfp.queueFamilyProperties.queueCount);
                 dqci.pQueuePriorities = queue_priorities.data();
                 dqcis.push_back(dqci);
             }
         }
+        // The queue that's most likely to be backed by a copy engine
+        std::optional<std::uint32_t> transfer_family;
+        if(transfer)
+        {
+            for(std::size_t i = 0; i < qfps.size(); i++)
+            {
+                auto flags = qfps[i].queueFamilyProperties.queueFlags;
+                if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_COMPUTE_BIT | VK_QUEUE_GRAPHICS_BIT)))
+                {
+                    transfer_family = static_cast<std::uint32_t>(i);
+                    break;
+                }
+            }
+        }
+        std::vector<VkDeviceQueueCreateInfo> all_dqcis = dqcis;
+        if(transfer_family)
+        {
+            dqci.queueFamilyIndex = *transfer_family;
+            dqci.queueCount = 1;
+            dqci.pQueuePriorities = queue_priorities.data();
+            all_dqcis.push_back(dqci);
+        }
+
 
+        // Workgroup scope matrices are only allowed with VK_NV_cooperative_matrix2's
+        // cooperativeMatrixWorkgroupScope, without it those entries get skipped
+        std::uint32_t extension_count = 0;
+        vkEnumerateDeviceExtensionProperties(phy_dev, nullptr, &extension_count, nullptr);
+        std::vector<VkExtensionProperties> device_extensions(extension_count);
+        vkEnumerateDeviceExtensionProperties(phy_dev, nullptr, &extension_count, device_extensions.data());
+        const bool has_cooperative_matrix2 = std::any_of(device_extensions.begin(), device_extensions.end(),
+                [](const VkExtensionProperties& eprops)
+        {
+            return eprops.extensionName == std::string("VK_NV_cooperative_matrix2");
+        });
+
+        VkPhysicalDeviceCooperativeMatrix2FeaturesNV pdcm2f
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_2_FEATURES_NV,
+        };
+        VkPhysicalDeviceCooperativeMatrix2PropertiesNV pdcm2p
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_2_PROPERTIES_NV,
+        };
+        if(has_cooperative_matrix2)
+        {
+            VkPhysicalDeviceFeatures2 features
+            {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+                .pNext = &pdcm2f,
+            };
+            vkGetPhysicalDeviceFeatures2(phy_dev, &features);
+            VkPhysicalDeviceProperties2 cm2_properties
+            {
+                .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+                .pNext = &pdcm2p,
+            };
+            vkGetPhysicalDeviceProperties2(phy_dev, &cm2_properties);
+        }
+        const bool workgroup_scope = has_cooperative_matrix2 && pdcm2f.cooperativeMatrixWorkgroupScope;
+        // Only the one feature we need, the rest of the extension stays off
+        pdcm2f = VkPhysicalDeviceCooperativeMatrix2FeaturesNV
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_2_FEATURES_NV,
+            .pNext = nullptr,
+            .cooperativeMatrixWorkgroupScope = VK_TRUE,
+        };
+        auto extensions_to_enable = device_extensions_to_enable;
+        if(workgroup_scope)
+        {
+            extensions_to_enable.push_back("VK_NV_cooperative_matrix2");
+        }
 
         VkPhysicalDeviceCooperativeMatrixFeaturesKHR pdcmf = 
         {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_FEATURES_KHR,
-            .pNext = nullptr,
+            .pNext = workgroup_scope ? &pdcm2f : nullptr,
             .cooperativeMatrix = VK_TRUE,
             .cooperativeMatrixRobustBufferAccess = VK_FALSE,
         };
@@ -348,16 +873,23 @@ int main()
         VkDeviceCreateInfo dci{};
         dci.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
         dci.pNext = &pdv13f;
-        dci.enabledExtensionCount = device_extensions_to_enable.size();
-        dci.ppEnabledExtensionNames = device_extensions_to_enable.data();
-        dci.queueCreateInfoCount = dqcis.size();
-        dci.pQueueCreateInfos = dqcis.data();
+        dci.enabledExtensionCount = extensions_to_enable.size();
+        dci.ppEnabledExtensionNames = extensions_to_enable.data();
+        dci.queueCreateInfoCount = all_dqcis.size();
+        dci.pQueueCreateInfos = all_dqcis.data();
 
         VkDevice device;
         vkCreateDevice(phy_dev, &dci, nullptr, &device);
 
 
-        device_dqcis[device] = dqcis;
+        // Normal benchmarks use the first queue of the first family,
+        // the others are only used with --multi-queue (and --transfer)
+        auto& context = *(device_contexts[device] = std::make_unique<device_context>(
+                    phy_dev, device, dqcis, transfer_family, binding));
+        if(use_pipeline_cache)
+        {
+            context.enable_pipeline_cache(pipeline_cache_directory);
+        }
 
 
         fmt::print("Physical device {}:\n", pd_idx);
@@ -366,10 +898,15 @@ int main()
         {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_COOPERATIVE_MATRIX_PROPERTIES_KHR
         };
+        VkPhysicalDeviceVulkan12Properties pdv12p
+        {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES,
+            .pNext = &pdcmp,
+        };
         VkPhysicalDeviceVulkan11Properties pdv11p
         {
             .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES,
-            .pNext = &pdcmp,
+            .pNext = &pdv12p,
         };
         VkPhysicalDeviceSubgroupSizeControlProperties pdsgscp =
         {
@@ -383,6 +920,8 @@ int main()
         };
         vkGetPhysicalDeviceProperties2(phy_dev, &properties);
 
+        std::string driver_version = driver_version_to_str(properties, pdv12p);
+
         fmt::print("    Supports Cooperative Matrices in the following shader stages:\n");
 
         auto check_stage = [](auto bits, auto bit_to_check)
@@ -437,39 +976,73 @@ int main()
         fmt::print("        M  x  N x  K,   A,   B,   C,   D,  scope, sat\n");
 
         std::vector<VkCooperativeMatrixPropertiesKHR> skipped_cmprops;
-
-        for(auto& cmprop : cmprops)
+        // Entries with ResultType != CType but without a (A, B, ResultType, ResultType) entry to run as
+        std::size_t skipped_mixed_result = 0;
+        // Component types past VK_COMPONENT_TYPE_UINT64_KHR (BFloat16, the FP8 formats, ...) that were reported
+        std::set<std::uint32_t> unhandled_types;
+        // Workgroup scope entries on a device without cooperativeMatrixWorkgroupScope
+        std::size_t skipped_workgroup_scope = 0;
+
+        for(auto cmprop : cmprops)
         {
 
+            // Whatever the sweep isn't interested in, by what the device reported
+            if(!spec.matches_configuration(cmprop))
+            {
+                skipped_cmprops.push_back(cmprop);
+                continue;
+            }
+
+            for(auto type : {cmprop.AType, cmprop.BType, cmprop.CType, cmprop.ResultType})
+            {
+                if(type > VK_COMPONENT_TYPE_UINT64_KHR)
+                {
+                    unhandled_types.insert(static_cast<std::uint32_t>(type));
+                }
+            }
+
             bool skip = false;
-            if (VK_SCOPE_SUBGROUP_KHR != cmprop.scope)
+            // Subgroup and workgroup scope only, the kernel has no idea what to do
+            // with matrices that span a queue family or the whole device
+            if (VK_SCOPE_SUBGROUP_KHR != cmprop.scope && VK_SCOPE_WORKGROUP_KHR != cmprop.scope)
             {
-                //fmt::print("Only subgroups supported right now, skipping\n");
                 skip = true;
             }
-	        // s8 + u8 exposed by AMD and fails, not sure what's wrong
-            if (cmprop.AType != cmprop.BType)
+            if(VK_SCOPE_WORKGROUP_KHR == cmprop.scope && !workgroup_scope)
             {
-                //fmt::print("known buggy type, skipping\n");
+                skipped_workgroup_scope++;
                 skip = true;
             }
-	        // I don't know what the AMDGPU pro vulkan driver exposes here, but
-            // there is no VkComponentTypeKHR with integer value 1000142000,
-            // Max value according to current spec is 10
-            constexpr std::uint32_t max_ct_value = 10;
-            auto type_check = [max_ct_value](auto c, auto t)
+            // GLSL's coopMatMulAdd always returns the type of its C operand, so glslang can't emit a
+            // MulAdd with ResultType != CType. Converting C on load would run (A, B, R, R), which is only
+            // allowed if the device reports that, and then it's simply that entry. Measured and recorded
+            // as the same shape with C in ResultType, or skipped if there is none
+            const auto reported_c_type = cmprop.CType;
+            if(!skip && cmprop.CType != cmprop.ResultType)
             {
-                if (t > max_ct_value)
+                auto same_result = std::find_if(cmprops.begin(), cmprops.end(), [&cmprop](const auto& other)
+                {
+                    return (other.MSize == cmprop.MSize) && (other.NSize == cmprop.NSize) &&
+                           (other.KSize == cmprop.KSize) && (other.AType == cmprop.AType) &&
+                           (other.BType == cmprop.BType) && (other.CType == cmprop.ResultType) &&
+                           (other.ResultType == cmprop.ResultType) &&
+                           (other.saturatingAccumulation == cmprop.saturatingAccumulation) &&
+                           (other.scope == cmprop.scope);
+                });
+                if(same_result == cmprops.end())
                 {
-                    //fmt::print("unsupported {} type (value={}), skipping\n", c, static_cast<std::uint32_t>(t));
-                    return false;
+                    skipped_mixed_result++;
+                    skipped_cmprops.push_back(cmprop);
+                    continue;
                 }
-                return true;
-            };
-            skip = skip || !type_check("a", cmprop.AType);
-            skip = skip || !type_check("b", cmprop.BType);
-            skip = skip || !type_check("c", cmprop.CType);
-            skip = skip || !type_check("d", cmprop.ResultType);
+                cmprop = *same_result;
+            }
+	        // I don't know what the AMDGPU pro vulkan driver exposes here, but
+            // there is no VkComponentTypeKHR with integer value 1000142000,
+            // Max value according to current spec is 10.
+            // Everything else (mixed signedness, float inputs into integers, ...) goes through
+            // the type table of create_coop_benchmark, which knows what it can't do
+            skip = skip || !coop_benchmark_supports(cmprop);
 
             if(skip)
             {
@@ -485,6 +1058,11 @@ int main()
                     component_type_to_str(cmprop.ResultType),
                     scope_to_str(cmprop.scope),
                     cmprop.saturatingAccumulation);
+            if(reported_c_type != cmprop.CType)
+            {
+                fmt::print("          (reported with C as {}, runs and is recorded as above)\n",
+                        component_type_to_str(reported_c_type));
+            }
 
             // Somewhat confused about this.
             // On Windows the AMD driver has emulated cooperative matrices on RDNA2,
@@ -492,45 +1070,126 @@ int main()
             // setting it to 32 makes validation layers complain about it being less than
             // subgroupSize, but I think that's a false positive, since minSubgroupSize=32?
             // Using subroupSize for now, as the validation layer just repeats what the spec says
-            std::uint32_t subgroup_size = pdv11p.subgroupSize;
+            std::uint32_t subgroup_size = context.get_subgroup_size();
             //std::uint32_t subgroup_size = 32;
-            //std::uint32_t subgroup_size = pdsgscp.minSubgroupSize;
+            //std::uint32_t subgroup_size = context.get_min_subgroup_size();
 
-            auto benchmark = create_coop_benchmark(
-                    phy_dev, device, cmprop,
-                    insts_in_block, inner_iterations, num_repetitions, num_groups);
+            auto tuning_key = tuning_database::make_key(
+                    properties.properties.deviceName, driver_version, cmprop);
+            tuning_parameters tuned_parameters = default_tuning;
+            if(auto tuned = tunings.find(tuning_key))
+            {
+                tuned_parameters = tuned->parameters;
+            }
 
-            dpkey shader_key = std::make_pair(device, cmprop);
+            // One job per point of the sweep, empty lists stay at the tuned value.
+            // The tuner only looks at the tuned point, it sweeps on its own
+            auto or_tuned = [](const std::vector<std::uint32_t>& values, std::uint32_t tuned)
+            {
+                return values.empty() ? std::vector<std::uint32_t>{tuned} : values;
+            };
+            const auto blocks_values = or_tuned(autotune ? std::vector<std::uint32_t>{} : spec.blocks_in_kernel,
+                    tuned_parameters.blocks_in_kernel);
+            const auto insts_values = or_tuned(autotune ? std::vector<std::uint32_t>{} : spec.insts_in_block,
+                    tuned_parameters.insts_in_block);
+            const auto groups_values = or_tuned(autotune ? std::vector<std::uint32_t>{} : spec.num_groups,
+                    tuned_parameters.num_groups);
+            const auto inner_values = autotune ? std::vector<std::uint32_t>{inner_iterations} : spec.inner_iterations;
+            const auto workgroup_values = autotune ? std::vector<std::uint32_t>{1} : spec.workgroup_subgroups;
+
+            // More subgroups per workgroup than the device takes in one workgroup. Workgroup scope
+            // matrices have their own limit, and want a power of two number of subgroups
+            const auto& limits = properties.properties.limits;
+            auto workgroup_fits = [&](std::uint32_t workgroup_subgroups)
+            {
+                const std::uint64_t invocations = std::uint64_t{workgroup_subgroups}*subgroup_size;
+                const bool scope_fits = (cmprop.scope != VK_SCOPE_WORKGROUP_KHR) ||
+                    ((invocations <= pdcm2p.cooperativeMatrixWorkgroupScopeMaxWorkgroupSize) &&
+                     std::has_single_bit(workgroup_subgroups));
+                return (invocations <= limits.maxComputeWorkGroupInvocations) &&
+                       (invocations <= limits.maxComputeWorkGroupSize[0]) &&
+                       (workgroup_subgroups <= pdsgscp.maxComputeWorkgroupSubgroups) &&
+                       scope_fits;
+            };
+
+            // First job of the current point with all its workgroup sizes, for the comparison at the end
+            std::optional<std::size_t> workgroup_sweep_start;
 
-            if(auto findit = shaders.find(shader_key); findit != shaders.end())
+            for(auto blocks_in_kernel : blocks_values)
+            for(auto insts_in_block : insts_values)
+            for(auto num_groups : groups_values)
+            for(auto job_inner_iterations : inner_values)
+            for(auto workgroup_subgroups : workgroup_values)
             {
+                if(workgroup_subgroups == workgroup_values.front())
+                {
+                    workgroup_sweep_start.reset();
+                }
+                if(blocks_in_kernel == 0 || insts_in_block == 0 || num_groups == 0 || job_inner_iterations == 0 ||
+                   workgroup_subgroups == 0 || !workgroup_fits(workgroup_subgroups))
+                {
+                    dropped_sweep_points++;
+                    continue;
+                }
+                // num_groups stays the number of tile sets. With subgroup scope every subgroup has one,
+                // so it's rounded up to whole workgroups, with workgroup scope every workgroup has one
+                tuning_parameters tuning
+                {
+                    .blocks_in_kernel = blocks_in_kernel,
+                    .insts_in_block = insts_in_block,
+                    .num_groups = (cmprop.scope == VK_SCOPE_SUBGROUP_KHR) ?
+                        (num_groups + workgroup_subgroups - 1)/workgroup_subgroups*workgroup_subgroups : num_groups,
+                };
+                // Every workgroup is along x
+                const auto dispatch_groups = (cmprop.scope == VK_SCOPE_SUBGROUP_KHR) ?
+                    tuning.num_groups/workgroup_subgroups : tuning.num_groups;
+                if(dispatch_groups > limits.maxComputeWorkGroupCount[0])
+                {
+                    dropped_sweep_points++;
+                    continue;
+                }
+                if(!job_keys.emplace(device, tuning_key, cmprop.scope, tuning.blocks_in_kernel, tuning.insts_in_block,
+                                     tuning.num_groups, job_inner_iterations, workgroup_subgroups).second)
+                {
+                    duplicate_sweep_points++;
+                    continue;
+                }
+
+                auto benchmark = create_coop_benchmark(
+                        phy_dev, device, cmprop,
+                        tuning.insts_in_block, job_inner_iterations, num_repetitions, tuning.num_groups);
+                benchmark->set_workgroup_subgroups(workgroup_subgroups);
+
+                dpkey shader_key = std::make_tuple(device, cmprop, tuning.insts_in_block, tuning.blocks_in_kernel,
+                        workgroup_subgroups);
+
                 // Idea is to only compile GLSL->SPIR-V once
-                // This also means that this shader only exists in the lifetime of the benchmark object
-                // (actually this might be good?)
-                benchmark->set_shader(std::make_shared<coopmat_benchmark_shader>(*findit->second.get()));
-            }
-            else
-            {
-                // TODO: Shader compilation should probably happend independently from 
-                //       instantiation in a real-world scenario
-                //fmt::print("compiling GLSL->SPIR-V for {:3}, {:3}, {:3}\n", 
-                //    component_type_to_str(cmprop.AType),
-                //    component_type_to_str(cmprop.BType),
-                //    component_type_to_str(cmprop.CType));
-                shaders[shader_key] = std::make_shared<coopmat_benchmark_shader>(
-                        device, code_str,
-                        cmprop.AType, cmprop.BType, cmprop.CType,
-                        subgroup_size,
-                        insts_in_block,
-                        blocks_in_kernel);
-                if(auto findit = device_shader_configs.find(device); findit == device_shader_configs.end())
+                auto [findit, inserted] = shaders.try_emplace(shader_key, shader_variants.size());
+                if(inserted)
                 {
-                    device_shader_configs[device] = coopmat_benchmark_shader::create_configuration(device);
+                    shader_variants.push_back(shader_variant{
+                            .device = device,
+                            .code_template = code_str,
+                            .macros = coopmat_benchmark_shader::make_macros(
+                                cmprop, subgroup_size, tuning.insts_in_block, tuning.blocks_in_kernel,
+                                workgroup_subgroups),
+                            .subgroup_size = subgroup_size});
                 }
-                benchmark->set_shader(shaders[shader_key]);
-            }
 
-            benchmarks.push_back(std::move(benchmark));
+                benchmarks.push_back(benchmark_job{
+                        .benchmark = std::move(benchmark),
+                        .kernel = "mma",
+                        .tuning = tuning,
+                        .tuning_key = tuning_key,
+                        .device_name = properties.properties.deviceName,
+                        .driver_version = driver_version,
+                        .subgroup_size = subgroup_size,
+                        .shader_variant = findit->second,
+                        .inner_iterations = job_inner_iterations,
+                        .workgroup_sweep_of = workgroup_sweep_start.value_or(benchmarks.size())});
+                workgroup_sweep_start = benchmarks.back().workgroup_sweep_of;
+                sweep_points++;
+            }
         }
 
         if(!skipped_cmprops.empty())
@@ -550,85 +1209,991 @@ int main()
                     scope_to_str(cmprop.scope),
                     cmprop.saturatingAccumulation);
         }
+        if(skipped_mixed_result > 0)
+        {
+            fmt::print("    {} of them have ResultType != CType and no entry with C in ResultType to run as instead,\n"
+                       "    GLSL's coopMatMulAdd can't produce a result type other than C's\n", skipped_mixed_result);
+        }
+        if(skipped_workgroup_scope > 0)
+        {
+            fmt::print("    {} of them have workgroup scope, which needs VK_NV_cooperative_matrix2 with "
+                       "cooperativeMatrixWorkgroupScope\n", skipped_workgroup_scope);
+        }
+        if(!unhandled_types.empty())
+        {
+            std::string type_list;
+            for(auto type : unhandled_types)
+            {
+                type_list += fmt::format("{}{}", type_list.empty() ? "" : ", ", type);
+            }
+            fmt::print("    VkComponentTypeKHR {} (BFloat16, FP8, ...) aren't supported, the kernel only knows f16 to u64\n",
+                    type_list);
+        }
+
+        // Empty, load only and load+store versions of every mma configuration, so the
+        // differences between them tell where the time of the full kernel goes
+        if(phases && !autotune)
+        {
+            const std::size_t mma_job_count = benchmarks.size();
+            for(std::size_t reference = 0; reference < mma_job_count; reference++)
+            {
+                if(benchmarks[reference].kernel != "mma" || benchmarks[reference].benchmark->get_device() != device)
+                {
+                    continue;
+                }
+                // push_back below invalidates references into benchmarks
+                auto cmprop = benchmarks[reference].benchmark->get_cmprops();
+                auto tuning = benchmarks[reference].tuning;
+                auto subgroup_size = benchmarks[reference].subgroup_size;
+                auto reference_inner_iterations = benchmarks[reference].inner_iterations;
+                auto workgroup_subgroups = benchmarks[reference].benchmark->get_workgroup_subgroups();
+                for(auto phase : {kernel_phase::empty, kernel_phase::load, kernel_phase::load_store})
+                {
+                    auto benchmark = create_coop_benchmark(
+                            phy_dev, device, cmprop,
+                            tuning.insts_in_block, reference_inner_iterations, num_repetitions, tuning.num_groups);
+                    benchmark->set_phase(phase);
+                    benchmark->set_workgroup_subgroups(workgroup_subgroups);
+
+                    auto macros = coopmat_benchmark_shader::make_macros(
+                            cmprop, subgroup_size, tuning.insts_in_block, tuning.blocks_in_kernel,
+                            workgroup_subgroups);
+                    add_kernel_phase_macros(macros, phase);
+                    shader_variants.push_back(shader_variant{
+                            .device = device,
+                            .code_template = code_str,
+                            .macros = std::move(macros),
+                            .subgroup_size = subgroup_size});
+
+                    benchmarks.push_back(benchmark_job{
+                            .benchmark = std::move(benchmark),
+                            .kernel = fmt::format("mma-{}", kernel_phase_to_str(phase)),
+                            .tuning = tuning,
+                            .tuning_key = benchmarks[reference].tuning_key,
+                            .device_name = benchmarks[reference].device_name,
+                            .driver_version = benchmarks[reference].driver_version,
+                            .subgroup_size = subgroup_size,
+                            .shader_variant = shader_variants.size() - 1,
+                            .phase_of = reference,
+                            .inner_iterations = reference_inner_iterations});
+                }
+            }
+        }
+
+        // Real GEMMs for every configuration the device benchmarks
+        if(!gemm_sizes.empty() && !autotune)
+        {
+            const std::size_t mma_job_count = benchmarks.size();
+            std::vector<VkCooperativeMatrixPropertiesKHR> gemm_cmprops;
+            for(std::size_t reference = 0; reference < mma_job_count; reference++)
+            {
+                if(benchmarks[reference].kernel != "mma" || benchmarks[reference].benchmark->get_device() != device)
+                {
+                    continue;
+                }
+                auto cmprop = benchmarks[reference].benchmark->get_cmprops();
+                // The kernel accumulates and stores in C's type, never saturates, and its tiles belong to subgroups
+                if(cmprop.CType != cmprop.ResultType || cmprop.saturatingAccumulation ||
+                   cmprop.scope != VK_SCOPE_SUBGROUP_KHR)
+                {
+                    continue;
+                }
+                // Once per configuration, the first sweep point is the reference
+                auto same_configuration = [&cmprop](const VkCooperativeMatrixPropertiesKHR& other)
+                {
+                    return (cmprop.MSize == other.MSize) && (cmprop.NSize == other.NSize) &&
+                           (cmprop.KSize == other.KSize) && (cmprop.AType == other.AType) &&
+                           (cmprop.BType == other.BType) && (cmprop.CType == other.CType) &&
+                           (cmprop.ResultType == other.ResultType);
+                };
+                if(std::any_of(gemm_cmprops.begin(), gemm_cmprops.end(), same_configuration))
+                {
+                    continue;
+                }
+                gemm_cmprops.push_back(cmprop);
+                for(auto size : gemm_sizes)
+                {
+                    auto benchmark = std::make_unique<coopmat_gemm_benchmark>(
+                            phy_dev, device, cmprop, size, default_gemm_tiling, num_repetitions);
+                    std::uint32_t subgroup_size = context.get_subgroup_size();
+                    const auto& limits = context.get_properties().limits;
+                    if(benchmark->get_shared_memory_bytes() > limits.maxComputeSharedMemorySize ||
+                       benchmark->get_workgroup_subgroups()*subgroup_size > limits.maxComputeWorkGroupInvocations)
+                    {
+                        fmt::print("    Skipping {} for {}: tiling doesn't fit the device limits\n",
+                                benchmark->get_name(), component_type_to_str(cmprop.AType));
+                        continue;
+                    }
+                    // One workgroup per block of C, all of them along x
+                    const auto workgroups = benchmark->get_num_groups()/benchmark->get_workgroup_subgroups();
+                    if(workgroups > limits.maxComputeWorkGroupCount[0])
+                    {
+                        fmt::print("    Skipping {} for {}: {} workgroups, the device dispatches at most {}\n",
+                                benchmark->get_name(), component_type_to_str(cmprop.AType),
+                                workgroups, limits.maxComputeWorkGroupCount[0]);
+                        continue;
+                    }
+
+                    shader_variants.push_back(shader_variant{
+                            .device = device,
+                            .code_template = gemm_code_str,
+                            .macros = benchmark->make_macros(subgroup_size),
+                            .subgroup_size = subgroup_size});
+
+                    auto kernel = benchmark->get_name();
+                    auto num_groups = static_cast<std::uint32_t>(benchmark->get_num_groups());
+                    benchmarks.push_back(benchmark_job{
+                            .benchmark = std::move(benchmark),
+                            .kernel = std::move(kernel),
+                            .tuning = tuning_parameters{
+                                .blocks_in_kernel = 1,
+                                .insts_in_block = 1,
+                                .num_groups = num_groups},
+                            .device_name = properties.properties.deviceName,
+                            .driver_version = driver_version,
+                            .subgroup_size = subgroup_size,
+                            .shader_variant = shader_variants.size() - 1,
+                            .reference_job = reference,
+                            .inner_iterations = inner_iterations});
+                }
+            }
+        }
+
+        // Load/store bandwidth for every A type (and tile shape) the device can do
+        if(bandwidth && !autotune)
+        {
+            // Only configurations that weren't skipped above
+            std::vector<VkCooperativeMatrixPropertiesKHR> tile_cmprops;
+            for(const auto& job : benchmarks)
+            {
+                auto cmprop = job.benchmark->get_cmprops();
+                auto same_tile = [&cmprop](const VkCooperativeMatrixPropertiesKHR& other)
+                {
+                    return (cmprop.AType == other.AType) &&
+                           (cmprop.MSize == other.MSize) &&
+                           (cmprop.KSize == other.KSize);
+                };
+                // The bandwidth kernel only knows subgroup scope tiles
+                if(job.benchmark->get_device() == device && cmprop.scope == VK_SCOPE_SUBGROUP_KHR &&
+                   std::find_if(tile_cmprops.begin(), tile_cmprops.end(), same_tile) == tile_cmprops.end())
+                {
+                    tile_cmprops.push_back(cmprop);
+                }
+            }
+
+            for(const auto& cmprop : tile_cmprops)
+            {
+                for(auto mode : {bandwidth_mode::load, bandwidth_mode::store, bandwidth_mode::copy})
+                for(bool column_major : {false, true})
+                for(std::uint32_t stride_factor : {1u, 2u})
+                for(auto working_set_bytes : spec.bandwidth_sizes)
+                {
+                    auto benchmark = std::make_unique<coopmat_bandwidth_benchmark>(
+                            phy_dev, device, cmprop,
+                            bandwidth_parameters{
+                                .mode = mode,
+                                .column_major = column_major,
+                                .stride_factor = stride_factor,
+                                .working_set_bytes = working_set_bytes},
+                            bandwidth_tiles_per_iteration,
+                            inner_iterations, num_repetitions, default_tuning.num_groups);
+                    std::uint32_t subgroup_size = context.get_subgroup_size();
+
+                    shader_variants.push_back(shader_variant{
+                            .device = device,
+                            .code_template = bandwidth_code_str,
+                            .macros = benchmark->make_macros(subgroup_size),
+                            .subgroup_size = subgroup_size});
+
+                    auto kernel = benchmark->get_name();
+                    benchmarks.push_back(benchmark_job{
+                            .benchmark = std::move(benchmark),
+                            .kernel = std::move(kernel),
+                            .tuning = tuning_parameters{
+                                .blocks_in_kernel = 1,
+                                .insts_in_block = bandwidth_tiles_per_iteration,
+                                .num_groups = default_tuning.num_groups},
+                            .device_name = properties.properties.deviceName,
+                            .driver_version = driver_version,
+                            .subgroup_size = subgroup_size,
+                            .shader_variant = shader_variants.size() - 1,
+                            .inner_iterations = inner_iterations});
+                }
+            }
+        }
+
+        // Copies, with the first mma configuration of the device as the kernel to overlap with
+        if(transfer && !autotune)
+        {
+            auto reference = std::find_if(benchmarks.begin(), benchmarks.end(), [device](const benchmark_job& job)
+            {
+                return job.kernel == "mma" && job.benchmark->get_device() == device;
+            });
+            if(reference == benchmarks.end())
+            {
+                fmt::print("    Skipping transfer benchmark: no mma configuration to overlap with\n");
+            }
+            else
+            {
+                auto benchmark = std::make_unique<coopmat_transfer_benchmark>(
+                        phy_dev, device, reference->benchmark->get_cmprops(), spec.transfer_sizes,
+                        reference->tuning.insts_in_block, inner_iterations, num_repetitions, reference->tuning.num_groups);
+                // Same shader as the reference, so the same workgroup size
+                benchmark->set_workgroup_subgroups(reference->benchmark->get_workgroup_subgroups());
+                auto job = benchmark_job{
+                        .benchmark = std::move(benchmark),
+                        .kernel = "transfer",
+                        .tuning = reference->tuning,
+                        .device_name = reference->device_name,
+                        .driver_version = reference->driver_version,
+                        .subgroup_size = reference->subgroup_size,
+                        .shader_variant = reference->shader_variant,
+                        .inner_iterations = inner_iterations};
+                benchmarks.push_back(std::move(job));
+            }
+        }
 
         devices.push_back(device);
     }
 
+    fmt::print("Sweep expanded to {} mma jobs", sweep_points);
+    if(dropped_sweep_points > 0)
+    {
+        fmt::print(", dropped {} with zero blocks/insts/groups/iterations or workgroups/dispatches too big for the device",
+                dropped_sweep_points);
+    }
+    if(duplicate_sweep_points > 0)
+    {
+        fmt::print(", skipped {} duplicates", duplicate_sweep_points);
+    }
+    fmt::print("\n");
 
-    // TODO: create a device->benchmark hierarchy
-    // This was fine when compiling shaders only, but probably bad for actually running/benchmarking
-    //#pragma omp parallel for
-    for(std::size_t i = 0; i < benchmarks.size(); i++)
+
+    // The tuner compiles its own shaders, everyone else gets theirs compiled and turned
+    // into pipelines up front, so that benchmarking only starts once everything is ready
+    if(!autotune)
     {
+        const std::size_t num_threads = default_thread_count();
+
+        // GLSL->SPIR-V (and shader module creation), one shaderc compiler per worker,
+        // created once the worker finds something that isn't precompiled or cached
+        auto compile_start = std::chrono::steady_clock::now();
+        std::vector<lazy_shaderc_compiler> compilers(num_threads);
+        parallel_for(shader_variants.size(), [&](std::size_t worker, std::size_t i)
+        {
+            auto& variant = shader_variants[i];
+            // Every template reads its addresses the way the device contexts pass them
+            coopmat_benchmark_shader::add_binding_macros(variant.macros, binding);
+            auto spirv = coopmat_benchmark_shader::compile(
+                    variant.code_template,
+                    variant.macros,
+                    shader_cache.get(),
+                    &compilers[worker]);
+            variant.shader = std::make_shared<coopmat_benchmark_shader>(
+                    variant.device, spirv, variant.subgroup_size);
+        }, num_threads);
+        auto compile_end = std::chrono::steady_clock::now();
+        fmt::print("Compiled {} shader variants in {:.1f} ms\n",
+                shader_variants.size(),
+                std::chrono::duration<double, std::milli>(compile_end - compile_start).count());
+
+        // Each benchmark gets its own copy, as the pipeline lives in the shader object
+        // (the shader module is shared)
+        for(auto& job : benchmarks)
+        {
+            job.benchmark->set_shader(std::make_shared<coopmat_benchmark_shader>(
+                        *shader_variants[job.shader_variant].shader));
+        }
+
+        // Pipelines, one vkCreateComputePipelines call with many create infos per worker and device
+        struct pipeline_batch
+        {
+            VkDevice device;
+            std::vector<coopmat_benchmark_shader*> shaders;
+            std::vector<VkCooperativeMatrixPropertiesKHR> cmprops;
+        };
+        std::vector<pipeline_batch> batches;
+        for(auto device : devices)
+        {
+            std::vector<std::size_t> device_jobs;
+            for(std::size_t i = 0; i < benchmarks.size(); i++)
+            {
+                if(benchmarks[i].benchmark->get_device() == device)
+                {
+                    device_jobs.push_back(i);
+                }
+            }
+            const std::size_t num_batches = std::min(num_threads, device_jobs.size());
+            for(std::size_t b = 0; b < num_batches; b++)
+            {
+                pipeline_batch batch{.device = device};
+                for(std::size_t j = b; j < device_jobs.size(); j += num_batches)
+                {
+                    auto& job = benchmarks[device_jobs[j]];
+                    batch.shaders.push_back(job.benchmark->get_shader().get());
+                    batch.cmprops.push_back(job.benchmark->get_cmprops());
+                }
+                batches.push_back(std::move(batch));
+            }
+        }
+
+        auto pipeline_start = std::chrono::steady_clock::now();
+        parallel_for(batches.size(), [&](std::size_t, std::size_t i)
+        {
+            auto& batch = batches[i];
+            coopmat_benchmark_shader::finalize_batch(
+                    batch.shaders, batch.cmprops,
+                    device_contexts.at(batch.device)->get_configuration());
+        }, num_threads);
+        auto pipeline_end = std::chrono::steady_clock::now();
+        fmt::print("Created {} pipelines in {:.1f} ms\n",
+                benchmarks.size(),
+                std::chrono::duration<double, std::milli>(pipeline_end - pipeline_start).count());
+    }
+
+    coopmat_autotuner tuner(code_str, tuning_margin, inner_iterations, num_repetitions, shader_cache.get(), measurement);
+
+    std::mutex tunings_mutex;
+
+    // The scaling sweep sets num_groups itself, so it runs once per configuration, blocks_in_kernel,
+    // insts_in_block and inner_iterations, not for every num_groups of the sweep
+    std::mutex scaling_mutex;
+    std::set<std::tuple<VkDevice, std::string, VkScopeKHR, std::uint32_t, std::uint32_t, std::uint32_t>> scaled_points;
+
+    // Returns the GOP/s of the job (median for benchmarks, best for tuning)
+    // Every job only ever touches its own entry, and jobs only reference
+    // jobs of the same device that ran before on the same thread
+    std::vector<double> job_gops_per_sec(benchmarks.size(), 0.0);
+    std::vector<double> job_median_nanoseconds(benchmarks.size(), 0.0);
+    // Ops of every dispatch run() did (warm-up included) and when it started/ended on the host,
+    // lockstep adds those up over the devices of a round
+    struct run_span
+    {
+        std::uint64_t ops = 0;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+    };
+    std::vector<run_span> job_run_spans(benchmarks.size());
+
+    // Differences between the cut-down kernels and the full one, once the last of them ran
+    auto print_phase_breakdown = [&](std::size_t full_job)
+    {
+        std::array<double, 4> medians{};
+        medians[static_cast<std::size_t>(kernel_phase::full)] = job_median_nanoseconds[full_job];
+        const auto& full_benchmark = *benchmarks[full_job].benchmark;
+        for(std::size_t i = 0; i < benchmarks.size(); i++)
+        {
+            if(benchmarks[i].phase_of == full_job)
+            {
+                medians[static_cast<std::size_t>(benchmarks[i].benchmark->get_phase())] = job_median_nanoseconds[i];
+            }
+        }
+        auto [empty, load, load_store, full] = medians;
+        // load and load-store both pay for the scratch copies on top of what their name says, and
+        // there is no kernel that only does those. load-store - load is what the C store costs, so
+        // the copies get estimated from that by bytes written, and moved from the loads to the mma loop
+        const double c_store = load_store - load;
+        const double scratch_stores = c_store*static_cast<double>(full_benchmark.get_scratch_store_bytes())/
+                                      static_cast<double>(full_benchmark.get_c_store_bytes());
+        fmt::print("Phase breakdown (median per dispatch, {:.0f} ns in total, {:.0f} ns scratch copies taken out):\n",
+                full, scratch_stores);
+        for(auto [name, nanoseconds] : {std::pair{"launch (empty kernel)", empty},
+                                        std::pair{"A/B/C loads", load - empty - scratch_stores},
+                                        std::pair{"C stores", c_store},
+                                        std::pair{"mma loop", full - load_store + scratch_stores}})
+        {
+            // Noise can make the small phases come out negative, that's left as is
+            fmt::print("    {:<22} {:>10.0f} ns {:>6.1f}%\n",
+                    name, nanoseconds, (full > 0.0) ? 100.0*nanoseconds/full : 0.0);
+        }
+    };
+    std::atomic<std::size_t> validation_failures{0};
+
+    // Buffer setup of the next job runs on another thread while the current one is busy on the GPU,
+    // so the host isn't what the sweep waits for (at the cost of two jobs' buffers at a time)
+    std::vector<std::future<void>> job_prepared(benchmarks.size());
+    auto prepare_job = [&](std::size_t job_index)
+    {
+        auto& job = benchmarks[job_index];
+        job.benchmark->set_measurement_settings(measurement);
+        job.benchmark->create_buffers(*device_contexts.at(job.benchmark->get_device()));
+    };
+
+    auto run_job = [&](std::size_t job_index, std::optional<std::size_t> next_job) -> double
+    {
+        auto& job = benchmarks[job_index];
+        if(!autotune)
+        {
+            if(job_prepared[job_index].valid())
+            {
+                job_prepared[job_index].get();
+            }
+            else
+            {
+                prepare_job(job_index);
+            }
+            if(next_job)
+            {
+                job_prepared[*next_job] = std::async(std::launch::async, prepare_job, *next_job);
+            }
+        }
+        auto cmprop = job.benchmark->get_cmprops();
         fmt::print("\n");
         fmt::print("=========================================================");
         fmt::print("\n");
-        auto cmprop = benchmarks[i]->get_cmprops();
-        benchmarks[i]->create_buffers();
-        fmt::print("Running benchmark for: {:2d} x {:2d} x {:2d}, {:3}, {:3}, {:3}, {:3}\n",
+        const auto workgroup_subgroups = job.benchmark->get_workgroup_subgroups();
+        fmt::print("{} benchmark on {} for: {:2d} x {:2d} x {:2d}, {:3}, {:3}, {:3}, {:3}{}{}{}\n",
+                autotune ? "Tuning" : "Running",
+                job.device_name,
                 cmprop.MSize, cmprop.NSize, cmprop.KSize,
                 component_type_to_str(cmprop.AType),
                 component_type_to_str(cmprop.BType),
                 component_type_to_str(cmprop.CType),
-                component_type_to_str(cmprop.ResultType));
-        auto device = benchmarks[i]->get_device();
-        auto config = device_shader_configs[device];
+                component_type_to_str(cmprop.ResultType),
+                cmprop.saturatingAccumulation ? ", saturating" : "",
+                (cmprop.scope == VK_SCOPE_WORKGROUP_KHR) ? ", workgroup scope" : "",
+                (workgroup_subgroups != 1) ? fmt::format(", {} subgroups per workgroup", workgroup_subgroups) : "");
+        auto& context = *device_contexts.at(job.benchmark->get_device());
+
+        double gops_per_sec = 0.0;
+        if(autotune)
+        {
+            auto best = tuner.tune(context, cmprop, job.subgroup_size, job.tuning);
+            fmt::print("Best: blocks_in_kernel={}, insts_in_block={}, num_groups={}: {:.2f} GOP/s\n",
+                    best.parameters.blocks_in_kernel,
+                    best.parameters.insts_in_block,
+                    best.parameters.num_groups,
+                    best.gops_per_sec);
+            std::lock_guard lock(tunings_mutex);
+            tunings.update(job.tuning_key, best);
+            gops_per_sec = best.gops_per_sec;
+        }
+        else if(auto transfer_benchmark = dynamic_cast<coopmat_transfer_benchmark*>(job.benchmark.get()))
+        {
+            auto result = transfer_benchmark->run_transfer(context, job.tuning.blocks_in_kernel);
+            if(results)
+            {
+                // One record per size and direction, bytes_per_dispatch tells them apart
+                for(auto& timing : result.sizes)
+                {
+                    for(auto [kernel, direction] : {std::pair{"transfer-upload", &timing.upload},
+                                                    std::pair{"transfer-download", &timing.download}})
+                    {
+                        results->write(benchmark_record{
+                                .kernel = kernel,
+                                .device_name = job.device_name,
+                                .driver_version = job.driver_version,
+                                .cmprops = cmprop,
+                                .subgroup_size = job.subgroup_size,
+                                .workgroup_subgroups = job.benchmark->get_workgroup_subgroups(),
+                                .tuning = job.tuning,
+                                .inner_iterations = 1,
+                                .outer_iterations = num_repetitions,
+                                .result = std::move(*direction)});
+                    }
+                }
+            }
+            transfer_benchmark->cleanup();
+            transfer_benchmark->destroy_buffers();
+        }
+        else
+        {
+            const auto run_start = std::chrono::steady_clock::now();
+            auto result = job.benchmark->run(context, job.tuning.blocks_in_kernel);
+            job_run_spans[job_index] = run_span
+            {
+                .ops = result.ops*(result.statistics.count + result.statistics.outliers + result.warmup_iterations),
+                .start = run_start,
+                .end = std::chrono::steady_clock::now(),
+            };
+            if(auto pc = context.get_pipeline_cache())
+            {
+                pc->record(result.pipeline_cache_hit, result.pipeline_creation_nanoseconds);
+            }
+            gops_per_sec = static_cast<double>(result.ops)/result.statistics.median;
+            job_median_nanoseconds[job_index] = result.statistics.median;
+            // The cut-down kernels are queued in phase order, so load+store is the last one
+            if(job.phase_of && job.benchmark->get_phase() == kernel_phase::load_store)
+            {
+                print_phase_breakdown(*job.phase_of);
+            }
+            std::optional<double> fraction_of_peak;
+            if(job.reference_job)
+            {
+                auto peak = job_gops_per_sec[*job.reference_job];
+                if(peak > 0.0)
+                {
+                    fraction_of_peak = gops_per_sec/peak;
+                }
+                fmt::print("Achieved {:.2f} TOP/s, {:.1f}% of the {:.2f} TOP/s peak of the mma kernel\n",
+                        gops_per_sec*1e-3, 100.0*fraction_of_peak.value_or(0.0), peak*1e-3);
+            }
+            std::optional<validation_result> validation;
+            if(validate)
+            {
+                validation = job.benchmark->validate(context, job.tuning.blocks_in_kernel, validation_seed);
+                if(!validation)
+                {
+                    fmt::print("Validation: no host reference for this kernel\n");
+                }
+                else
+                {
+                    fmt::print("Validation: {}, {} of {} elements wrong, max. error {} at {}, reference took {:.1f} ms\n",
+                            validation->passed ? "PASSED" : "FAILED",
+                            validation->mismatches, validation->checked,
+                            validation->max_error, validation->max_error_index,
+                            validation->reference_seconds*1e3);
+                    if(!validation->passed)
+                    {
+                        validation_failures++;
+                    }
+                }
+            }
+            std::optional<multi_queue_result> multi_queue_run;
+            if(multi_queue)
+            {
+                multi_queue_run = job.benchmark->run_multi_queue(context, job.tuning.blocks_in_kernel, multi_queue_rounds);
+                if(gops_per_sec > 0.0)
+                {
+                    fmt::print("    {:.2f}x the single queue median ({:+.1f}%)\n",
+                            multi_queue_run->aggregate_gops_per_sec/gops_per_sec,
+                            100.0*(multi_queue_run->aggregate_gops_per_sec/gops_per_sec - 1.0));
+                }
+            }
+            // Launch overhead doesn't depend on what the kernel does, the mma one stands in for all of them
+            std::vector<latency_result> latencies;
+            if(latency && job.kernel == "mma")
+            {
+                latencies = job.benchmark->run_latency(context, latency_samples);
+            }
+            std::optional<scaling_result> sweep;
+            // The tuner's kernels have a subgroup per workgroup, so only the jobs with those
+            bool first_of_point = false;
+            if(scaling && job.kernel == "mma" && job.benchmark->get_workgroup_subgroups() == 1)
+            {
+                std::lock_guard lock(scaling_mutex);
+                first_of_point = scaled_points.emplace(job.benchmark->get_device(), job.tuning_key, cmprop.scope,
+                        job.tuning.blocks_in_kernel, job.tuning.insts_in_block, job.inner_iterations).second;
+            }
+            if(first_of_point)
+            {
+                sweep = tuner.sweep_num_groups(context, cmprop, job.subgroup_size, job.tuning, job.inner_iterations,
+                        scaling_fraction);
+                constexpr std::size_t bar_width = 40;
+                fmt::print("Scaling (blocks_in_kernel={}, insts_in_block={}, inner_iterations={}):\n",
+                        job.tuning.blocks_in_kernel, job.tuning.insts_in_block, job.inner_iterations);
+                fmt::print("    subgroups median GOP/s  of peak\n");
+                for(const auto& point : sweep->points)
+                {
+                    double fraction = point.gops_per_sec/sweep->peak_gops_per_sec;
+                    fmt::print("    {:>9} {:>12.2f} {:>8.1f}% {}{}\n",
+                            point.num_groups, point.gops_per_sec, 100.0*fraction,
+                            std::string(static_cast<std::size_t>(fraction*bar_width), '#'),
+                            (point.num_groups == sweep->knee_num_groups) ? " <- knee" : "");
+                }
+                fmt::print("Peak {:.2f} GOP/s, {:.0f}% of it from {} subgroups ({} invocations) on, "
+                           "~{:.0f} subgroups effectively run at full speed at once\n",
+                        sweep->peak_gops_per_sec, 100.0*sweep->knee_fraction,
+                        sweep->knee_num_groups, sweep->knee_num_groups*job.subgroup_size,
+                        sweep->effective_concurrent_subgroups);
+            }
+            if(results)
+            {
+                results->write(benchmark_record{
+                        .kernel = job.kernel,
+                        .device_name = job.device_name,
+                        .driver_version = job.driver_version,
+                        .cmprops = cmprop,
+                        .subgroup_size = job.subgroup_size,
+                        .workgroup_subgroups = job.benchmark->get_workgroup_subgroups(),
+                        .tuning = job.tuning,
+                        .inner_iterations = job.inner_iterations,
+                        .outer_iterations = num_repetitions,
+                        .result = std::move(result),
+                        .validation = validation,
+                        .fraction_of_peak = fraction_of_peak});
+                // One record per dispatch size, tuning.num_groups tells them apart
+                if(sweep)
+                {
+                    for(auto& point : sweep->points)
+                    {
+                        auto tuning = job.tuning;
+                        tuning.num_groups = point.num_groups;
+                        results->write(benchmark_record{
+                                .kernel = "scaling",
+                                .device_name = job.device_name,
+                                .driver_version = job.driver_version,
+                                .cmprops = cmprop,
+                                .subgroup_size = job.subgroup_size,
+                                .tuning = tuning,
+                                .inner_iterations = job.inner_iterations,
+                                .outer_iterations = num_repetitions,
+                                .result = std::move(point.result)});
+                    }
+                }
+                // One record for all queues together and one per queue with timestamps, with a sample per
+                // round. Times are per dispatch (per round of one dispatch on every queue for the aggregate),
+                // so ops/time is the throughput like everywhere else. The aggregate's fraction_of_peak is
+                // its median over the single queue median of the job
+                if(multi_queue_run)
+                {
+                    auto write_multi_queue = [&](std::string kernel, const std::vector<double>& round_nanoseconds,
+                                                 std::uint64_t ops, std::optional<double> fraction_of_single)
+                    {
+                        std::vector<double> samples;
+                        for(auto nanoseconds : round_nanoseconds)
+                        {
+                            samples.push_back(nanoseconds/static_cast<double>(multi_queue_run->dispatches_per_queue));
+                        }
+                        auto stats = compute_timing_statistics(samples, measurement.statistics);
+                        results->write(benchmark_record{
+                                .kernel = std::move(kernel),
+                                .device_name = job.device_name,
+                                .driver_version = job.driver_version,
+                                .cmprops = cmprop,
+                                .subgroup_size = job.subgroup_size,
+                                .workgroup_subgroups = job.benchmark->get_workgroup_subgroups(),
+                                .tuning = job.tuning,
+                                .inner_iterations = job.inner_iterations,
+                                .outer_iterations = static_cast<std::uint32_t>(multi_queue_run->dispatches_per_queue),
+                                .result = benchmark_result{
+                                    .min_nanoseconds = stats.raw_min,
+                                    .avg_nanoseconds = stats.raw_mean,
+                                    .max_gops_per_sec = static_cast<double>(ops)/stats.raw_min,
+                                    .avg_gops_per_sec = static_cast<double>(ops)/stats.raw_mean,
+                                    .pipeline_creation_nanoseconds = 0.0,
+                                    .pipeline_cache_hit = false,
+                                    .timestamps = {},
+                                    .timestamp_period = context.get_timestamp_period(),
+                                    .ops = ops,
+                                    .bytes = 0,
+                                    .statistics = stats,
+                                    .warmup_iterations = static_cast<std::uint32_t>(multi_queue_run->dispatches_per_queue),
+                                    .warmup_settled = false},
+                                .fraction_of_peak = fraction_of_single});
+                    };
+                    write_multi_queue("multi-queue", multi_queue_run->wall_nanoseconds,
+                            multi_queue_run->ops*multi_queue_run->queues.size(),
+                            (gops_per_sec > 0.0) ? std::optional{multi_queue_run->aggregate_gops_per_sec/gops_per_sec}
+                                                 : std::nullopt);
+                    for(const auto& queue : multi_queue_run->queues)
+                    {
+                        if(!queue.nanoseconds.empty())
+                        {
+                            write_multi_queue(fmt::format("multi-queue-{}.{}", queue.family_index, queue.index_in_family),
+                                    queue.nanoseconds, multi_queue_run->ops, std::nullopt);
+                        }
+                    }
+                }
+                // One record per mode, no raw timestamps (submit_to_fence doesn't have any)
+                for(auto& latency_run : latencies)
+                {
+                    results->write(benchmark_record{
+                            .kernel = fmt::format("latency-{}", latency_mode_to_str(latency_run.mode)),
+                            .device_name = job.device_name,
+                            .driver_version = job.driver_version,
+                            .cmprops = cmprop,
+                            .subgroup_size = job.subgroup_size,
+                            .workgroup_subgroups = job.benchmark->get_workgroup_subgroups(),
+                            .tuning = job.tuning,
+                            .inner_iterations = 0,
+                            .outer_iterations = static_cast<std::uint32_t>(latency_run.nanoseconds.size()),
+                            .result = benchmark_result{
+                                .min_nanoseconds = latency_run.statistics.raw_min,
+                                .avg_nanoseconds = latency_run.statistics.raw_mean,
+                                .max_gops_per_sec = 0.0,
+                                .avg_gops_per_sec = 0.0,
+                                .pipeline_creation_nanoseconds = 0.0,
+                                .pipeline_cache_hit = false,
+                                .timestamps = {},
+                                .timestamp_period = context.get_timestamp_period(),
+                                .ops = 0,
+                                .bytes = 0,
+                                .statistics = latency_run.statistics,
+                                .warmup_iterations = 0,
+                                .warmup_settled = true}});
+                }
+            }
+            job.benchmark->cleanup();
+            job.benchmark->destroy_buffers();
+        }
 
+        fmt::print("=========================================================");
+        fmt::print("\n");
+        job_gops_per_sec[job_index] = gops_per_sec;
+        return gops_per_sec;
+    };
 
-        const auto& dqcis = device_dqcis[device];
+    if(parallel_devices && devices.size() > 1)
+    {
+        // One host thread per device, every device only ever touches its own
+        // context (queue, command buffers, descriptor set), so they don't need to sync.
+        // Output of the different devices will be interleaved
+        std::vector<std::vector<std::size_t>> device_jobs(devices.size());
+        for(std::size_t i = 0; i < benchmarks.size(); i++)
+        {
+            auto device = benchmarks[i].benchmark->get_device();
+            auto d = std::distance(devices.begin(), std::find(devices.begin(), devices.end(), device));
+            device_jobs[d].push_back(i);
+        }
 
-        // I'm not sure what my idea was with saving queues from multiple families,
-        // so just take the first one
-        const auto& dqci = dqcis[0];
+        // In lockstep, round r starts the r-th job of every device at the same time and the next
+        // round waits until all of them are done, so we can see what the whole node does when all
+        // GPUs are busy
+        std::barrier round_barrier(static_cast<std::ptrdiff_t>(devices.size()));
+        std::mutex rounds_mutex;
+        struct lockstep_round
+        {
+            std::size_t devices = 0;
+            double sum_of_medians = 0.0;
+            std::uint64_t ops = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::time_point::max();
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::time_point::min();
+        };
+        std::vector<lockstep_round> rounds;
 
-        //TODO: move queue/command buffer allocations out of the loop and make them per-device
-        VkQueue queue;
+        std::exception_ptr error;
+        std::mutex error_mutex;
 
-        vkGetDeviceQueue(device, dqci.queueFamilyIndex, 0, &queue);
+        std::vector<std::thread> threads;
+        for(std::size_t d = 0; d < devices.size(); d++)
+        {
+            threads.emplace_back([&, d]()
+            {
+                try
+                {
+                    for(std::size_t r = 0; r < device_jobs[d].size(); r++)
+                    {
+                        if(lockstep)
+                        {
+                            round_barrier.arrive_and_wait();
+                        }
+                        auto next_job = (r + 1 < device_jobs[d].size()) ?
+                            std::optional(device_jobs[d][r+1]) : std::nullopt;
+                        auto gops_per_sec = run_job(device_jobs[d][r], next_job);
+                        {
+                            const auto& span = job_run_spans[device_jobs[d][r]];
+                            std::lock_guard lock(rounds_mutex);
+                            if(rounds.size() <= r)
+                            {
+                                rounds.resize(r+1);
+                            }
+                            auto& round = rounds[r];
+                            round.devices++;
+                            round.sum_of_medians += gops_per_sec;
+                            if(span.ops > 0)
+                            {
+                                round.ops += span.ops;
+                                round.start = std::min(round.start, span.start);
+                                round.end = std::max(round.end, span.end);
+                            }
+                        }
+                        if(lockstep)
+                        {
+                            round_barrier.arrive_and_wait();
+                        }
+                    }
+                }
+                catch(...)
+                {
+                    std::lock_guard lock(error_mutex);
+                    if(!error)
+                    {
+                        error = std::current_exception();
+                    }
+                }
+                // Don't keep the others waiting on a device that's done (or broken)
+                if(lockstep)
+                {
+                    round_barrier.arrive_and_drop();
+                }
+            });
+        }
+        for(auto& thread : threads)
+        {
+            thread.join();
+        }
+        if(error)
+        {
+            std::rethrow_exception(error);
+        }
 
-        //TODO: neither should this
-        VkCommandPool command_pool;
-        VkCommandPoolCreateInfo cpci
+        if(lockstep)
         {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            // TODO: Actually with transient buffers, we can leave the allocation in the loop (probably? benchmark idea?)
-            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
-            .queueFamilyIndex = dqci.queueFamilyIndex,
-        };
-        vkCreateCommandPool(device, &cpci, nullptr, &command_pool);
+            // The round's throughput is everything run() dispatched on all devices over the time from the
+            // first run() starting to the last one ending, pipeline creation included. The sum of medians
+            // assumes every device ran at its median the whole time, which it only does if the runs overlap
+            fmt::print("\nLockstep rounds (all ops over the round's wall time, and the sum of the per-device medians):\n");
+            for(std::size_t r = 0; r < rounds.size(); r++)
+            {
+                const auto& round = rounds[r];
+                if(round.ops == 0)
+                {
+                    fmt::print("    Round {:3d}: {} devices, sum of medians {:.2f} GOP/s\n",
+                            r, round.devices, round.sum_of_medians);
+                    continue;
+                }
+                const double wall_nanoseconds = std::chrono::duration<double, std::nano>(round.end - round.start).count();
+                fmt::print("    Round {:3d}: {} devices, {:.2f} GOP/s over {:.1f} ms, sum of medians {:.2f} GOP/s\n",
+                        r, round.devices, static_cast<double>(round.ops)/wall_nanoseconds,
+                        wall_nanoseconds*1e-6, round.sum_of_medians);
+            }
+        }
+    }
+    else
+    {
+        for(std::size_t i = 0; i < benchmarks.size(); i++)
+        {
+            run_job(i, (i + 1 < benchmarks.size()) ? std::optional(i + 1) : std::nullopt);
+        }
+    }
+
+    // Every sweep point with all of its workgroup sizes next to each other. Throughput relative to
+    // the first size (usually a single subgroup) shows what sharing a workgroup costs or gains,
+    // fewer but bigger workgroups change how many of them fit on a compute unit at once
+    if(!autotune && spec.workgroup_subgroups.size() > 1)
+    {
+        // Per device and workgroup size: sum of the log of the relative throughput, and how many points had it
+        std::map<std::string, std::map<std::uint32_t, std::pair<double, std::size_t>>> device_ratios;
+        std::map<std::string, std::size_t> device_points;
 
-        VkCommandBuffer command_buffer;
-        VkCommandBufferAllocateInfo cbai
+        fmt::print("\nSubgroups per workgroup:\n");
+        for(std::size_t first = 0; first < benchmarks.size(); first++)
         {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = command_pool,
-            .level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1,
-        };
-        vkAllocateCommandBuffers(device, &cbai, &command_buffer);
+            if(benchmarks[first].workgroup_sweep_of != first)
+            {
+                continue;
+            }
+            std::vector<std::size_t> members;
+            for(std::size_t i = first; i < benchmarks.size(); i++)
+            {
+                if(benchmarks[i].workgroup_sweep_of == first)
+                {
+                    members.push_back(i);
+                }
+            }
+            const auto& reference = benchmarks[first];
+            const double reference_gops = job_gops_per_sec[first];
+            if(members.size() < 2 || reference_gops <= 0.0)
+            {
+                continue;
+            }
+            auto cmprop = reference.benchmark->get_cmprops();
+            fmt::print("    {}: {:2d} x {:2d} x {:2d}, {:3}, {:3}, {:3}, {:3}{}, blocks_in_kernel={}, insts_in_block={}, inner_iterations={}\n",
+                    reference.device_name,
+                    cmprop.MSize, cmprop.NSize, cmprop.KSize,
+                    component_type_to_str(cmprop.AType),
+                    component_type_to_str(cmprop.BType),
+                    component_type_to_str(cmprop.CType),
+                    component_type_to_str(cmprop.ResultType),
+                    (cmprop.scope == VK_SCOPE_WORKGROUP_KHR) ? ", workgroup scope" : "",
+                    reference.tuning.blocks_in_kernel, reference.tuning.insts_in_block, reference.inner_iterations);
+            fmt::print("        subgroups  invocations  workgroups        GOP/s  vs. first\n");
+            auto best = *std::max_element(members.begin(), members.end(), [&](std::size_t a, std::size_t b)
+            {
+                return job_gops_per_sec[a] < job_gops_per_sec[b];
+            });
+            device_points[reference.device_name]++;
+            for(auto i : members)
+            {
+                const auto& job = benchmarks[i];
+                const auto workgroup_subgroups = job.benchmark->get_workgroup_subgroups();
+                const double ratio = job_gops_per_sec[i]/reference_gops;
+                fmt::print("        {:>9} {:>12} {:>11} {:>12.2f} {:>9.1f}%{}\n",
+                        workgroup_subgroups, workgroup_subgroups*job.subgroup_size,
+                        job.benchmark->get_dispatch_groups(), job_gops_per_sec[i], 100.0*ratio,
+                        (i == best) ? " <- best" : "");
+                if(ratio > 0.0)
+                {
+                    auto& [log_sum, count] = device_ratios[reference.device_name][workgroup_subgroups];
+                    log_sum += std::log(ratio);
+                    count++;
+                }
+            }
+        }
 
-        benchmarks[i]->run(config, queue, command_buffer, blocks_in_kernel);
-        benchmarks[i]->cleanup();
-        benchmarks[i]->destroy_buffers();
+        // Geometric mean, only over the sizes every point of the device had, so they're comparable
+        fmt::print("\nBest subgroups per workgroup (geometric mean over the configurations of each device):\n");
+        for(const auto& [device_name, ratios] : device_ratios)
+        {
+            std::optional<std::pair<std::uint32_t, double>> best;
+            for(const auto& [workgroup_subgroups, log_ratio] : ratios)
+            {
+                auto [log_sum, count] = log_ratio;
+                if(count != device_points[device_name])
+                {
+                    continue;
+                }
+                double mean = std::exp(log_sum/count);
+                if(!best || mean > best->second)
+                {
+                    best = std::pair{workgroup_subgroups, mean};
+                }
+            }
+            if(best)
+            {
+                fmt::print("    {}: {} subgroups per workgroup, {:.1f}% of the first size\n",
+                        device_name, best->first, 100.0*best->second);
+            }
+        }
+    }
 
-        vkFreeCommandBuffers(device, command_pool, 1, &command_buffer);
-        vkDestroyCommandPool(device, command_pool, nullptr);
-        fmt::print("=========================================================");
-        fmt::print("\n");
+    if(autotune)
+    {
+        fmt::print("\nTuned configurations (saved to {}):\n", tuning_file.string());
+        for(const auto& job : benchmarks)
+        {
+            if(auto tuned = tunings.find(job.tuning_key))
+            {
+                fmt::print("    {}: blocks_in_kernel={}, insts_in_block={}, num_groups={}, {:.2f} GOP/s\n",
+                        job.tuning_key,
+                        tuned->parameters.blocks_in_kernel,
+                        tuned->parameters.insts_in_block,
+                        tuned->parameters.num_groups,
+                        tuned->gops_per_sec);
+            }
+        }
+        tunings.save(tuning_file);
+    }
+
+    if(get_precompiled_spirv_count() > 0)
+    {
+        fmt::print("Precompiled SPIR-V: {} variants built in, {} used\n",
+                get_precompiled_spirv_count(), get_precompiled_spirv_hits());
+    }
+    if(shader_cache)
+    {
+        fmt::print("SPIR-V cache ({}): {} hits, {} misses\n",
+                shader_cache->get_directory().string(),
+                shader_cache->get_hits(),
+                shader_cache->get_misses());
     }
 
     // TODO: When adapting this to something more proper,
     //       deal with the lifetime of the 'VkShaderModule's more gracefully
-    for (auto& [_,shader] : shaders)
+    for (auto& variant : shader_variants)
     {
-        shader->destroy_shared_module();
+        if(variant.shader)
+        {
+            variant.shader->destroy_shared_module();
+        }
     }
     benchmarks.clear();
 
-    for (auto& [device,config] : device_shader_configs)
+    for (auto& [device,context] : device_contexts)
     {
-        coopmat_benchmark_shader::release_configuration(device, config);
+        const auto& arena = context->get_memory_arena();
+        fmt::print("Memory arena ({}): {} blocks, {:.1f} MiB\n",
+                context->get_properties().deviceName,
+                arena.get_block_count(),
+                static_cast<double>(arena.get_reserved_bytes())/(1 << 20));
+        if(auto cache = context->get_pipeline_cache())
+        {
+            cache->print_statistics();
+            cache->save();
+        }
     }
+    device_contexts.clear();
 
     for(std::size_t i = 0; i < devices.size(); i++)
     {
@@ -638,5 +2203,11 @@ int main()
 
 
     vkDestroyInstance(instance, nullptr);
+
+    if(validation_failures > 0)
+    {
+        fmt::print("{} benchmarks failed validation\n", validation_failures.load());
+        return 1;
+    }
     return 0;
 }
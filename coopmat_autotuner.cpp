@@ -0,0 +1,381 @@
+#include "coopmat_autotuner.hpp"
+#include "coopmat_benchmark.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace
+{
+    // Median based like the job results, a single lucky sample shouldn't decide
+    // which candidate wins or where the knee is
+    double median_gops_per_sec(const benchmark_result& result)
+    {
+        return (result.statistics.median > 0.0) ? static_cast<double>(result.ops)/result.statistics.median : 0.0;
+    }
+}
+
+std::string tuning_database::make_key(
+        std::string_view device_name,
+        std::string_view driver_version,
+        VkCooperativeMatrixPropertiesKHR cmprops)
+{
+    // Saturating entries get their own key, the ones without keep what they always had
+    return fmt::format("{}|{}|{}x{}x{}|{}|{}|{}|{}{}",
+            device_name, driver_version,
+            cmprops.MSize, cmprops.NSize, cmprops.KSize,
+            component_type_to_str(cmprops.AType),
+            component_type_to_str(cmprops.BType),
+            component_type_to_str(cmprops.CType),
+            component_type_to_str(cmprops.ResultType),
+            cmprops.saturatingAccumulation ? "|sat" : "");
+}
+
+void tuning_database::load(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        // Nothing tuned yet, that's fine
+        return;
+    }
+
+    std::string line;
+    while(std::getline(file, line))
+    {
+        if(line.empty() || line.front() == '#')
+        {
+            continue;
+        }
+
+        std::istringstream line_stream(line);
+        std::string key;
+        tuning_result result{};
+        if(!std::getline(line_stream, key, '\t') ||
+           !(line_stream >> result.parameters.blocks_in_kernel
+                         >> result.parameters.insts_in_block
+                         >> result.parameters.num_groups
+                         >> result.gops_per_sec))
+        {
+            fmt::print("Ignoring malformed line in tuning file {}: {}\n", path.string(), line);
+            continue;
+        }
+        entries[key] = result;
+    }
+}
+
+void tuning_database::save(const std::filesystem::path& path) const
+{
+    std::ofstream file(path, std::ios::trunc);
+    if(!file)
+    {
+        throw std::runtime_error("Failed to open tuning file for writing");
+    }
+
+    file << "# device|driver|MxNxK|A|B|C|D\tblocks_in_kernel\tinsts_in_block\tnum_groups\tmedian GOP/s\n";
+    for(const auto& [key, result] : entries)
+    {
+        file << fmt::format("{}\t{}\t{}\t{}\t{:.2f}\n",
+                key,
+                result.parameters.blocks_in_kernel,
+                result.parameters.insts_in_block,
+                result.parameters.num_groups,
+                result.gops_per_sec);
+    }
+}
+
+std::optional<tuning_result> tuning_database::find(const std::string& key) const
+{
+    if(auto findit = entries.find(key); findit != entries.end())
+    {
+        return findit->second;
+    }
+    return std::nullopt;
+}
+
+void tuning_database::update(const std::string& key, tuning_result result)
+{
+    entries[key] = result;
+}
+
+benchmark_result coopmat_autotuner::evaluate(
+        device_context& context,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        std::uint32_t subgroup_size,
+        tuning_parameters parameters,
+        std::uint32_t evaluate_inner_iterations,
+        shader_map& shaders)
+{
+    auto device = context.get_device();
+
+    // insts_in_block and blocks_in_kernel are baked into the shader, num_groups isn't,
+    // so only compile once per (insts_in_block, blocks_in_kernel)
+    auto shader_key = std::make_pair(parameters.insts_in_block, parameters.blocks_in_kernel);
+    auto findit = shaders.find(shader_key);
+    if(findit == shaders.end())
+    {
+        auto macros = coopmat_benchmark_shader::make_macros(
+                cmprops,
+                subgroup_size,
+                parameters.insts_in_block,
+                parameters.blocks_in_kernel);
+        coopmat_benchmark_shader::add_binding_macros(macros, context.get_configuration().binding);
+        findit = shaders.emplace(shader_key, std::make_shared<coopmat_benchmark_shader>(
+                    device,
+                    coopmat_benchmark_shader::compile(code_template, macros, cache),
+                    subgroup_size)).first;
+    }
+
+    auto benchmark = create_coop_benchmark(
+            context.get_phy_device(), device, cmprops,
+            parameters.insts_in_block, evaluate_inner_iterations, num_repetitions, parameters.num_groups);
+    benchmark->set_shader(std::make_shared<coopmat_benchmark_shader>(*findit->second));
+    benchmark->set_measurement_settings(measurement);
+    // Candidates and the scaling sweep can go past what one dispatch takes, those just fail
+    if(benchmark->get_num_groups() > context.get_properties().limits.maxComputeWorkGroupCount[0])
+    {
+        throw std::runtime_error(fmt::format("{} workgroups, the device dispatches at most {}",
+                    benchmark->get_num_groups(), context.get_properties().limits.maxComputeWorkGroupCount[0]));
+    }
+
+    benchmark_result result;
+    try
+    {
+        benchmark->create_buffers(context);
+        result = benchmark->run(context, parameters.blocks_in_kernel);
+    }
+    catch(...)
+    {
+        benchmark->cleanup();
+        benchmark->destroy_buffers();
+        throw;
+    }
+    benchmark->cleanup();
+    benchmark->destroy_buffers();
+
+    return result;
+}
+
+tuning_result coopmat_autotuner::tune(
+        device_context& context,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        std::uint32_t subgroup_size,
+        tuning_parameters start)
+{
+    shader_map shaders;
+    std::map<tuning_parameters, double> scores;
+
+    auto score = [&](tuning_parameters parameters) -> double
+    {
+        if(auto findit = scores.find(parameters); findit != scores.end())
+        {
+            return findit->second;
+        }
+
+        // Too many accumulators can fail to compile or to create a pipeline,
+        // that just means this configuration is out of the search space
+        double gops_per_sec = 0.0;
+        try
+        {
+            gops_per_sec = median_gops_per_sec(evaluate(
+                    context, cmprops, subgroup_size,
+                    parameters, inner_iterations, shaders));
+        }
+        catch(const std::runtime_error& e)
+        {
+            fmt::print("    Candidate failed: {}\n", e.what());
+        }
+        fmt::print("    Tuning blocks_in_kernel={:3d}, insts_in_block={:3d}, num_groups={:6d}: {:.2f} GOP/s (median)\n",
+                parameters.blocks_in_kernel, parameters.insts_in_block, parameters.num_groups,
+                gops_per_sec);
+        scores[parameters] = gops_per_sec;
+        return gops_per_sec;
+    };
+
+    tuning_result best{start, score(start)};
+
+    using knob = std::uint32_t tuning_parameters::*;
+    std::array<std::pair<knob, std::uint32_t>, 3> knobs
+    {{
+        {&tuning_parameters::insts_in_block, max_insts_in_block},
+        {&tuning_parameters::blocks_in_kernel, max_blocks_in_kernel},
+        {&tuning_parameters::num_groups, start.num_groups*max_group_factor},
+    }};
+
+    for(std::uint32_t pass = 0; pass < max_passes; pass++)
+    {
+        bool improved = false;
+        for(const auto& [member, upper] : knobs)
+        {
+            for(bool grow : {true, false})
+            {
+                bool moved = false;
+                while(true)
+                {
+                    auto candidate = best.parameters;
+                    auto& value = candidate.*member;
+                    if(grow)
+                    {
+                        if(value >= upper)
+                        {
+                            break;
+                        }
+                        // The last step goes to the bound itself, never past it
+                        value = static_cast<std::uint32_t>(std::min<std::uint64_t>(std::uint64_t{value}*2, upper));
+                    }
+                    else
+                    {
+                        if(value <= 1)
+                        {
+                            break;
+                        }
+                        value /= 2;
+                    }
+
+                    // Anything within the margin of the best so far isn't worth going further for,
+                    // (and we prefer the smaller configuration)
+                    auto gops_per_sec = score(candidate);
+                    if(gops_per_sec <= best.gops_per_sec*(1.0 + margin))
+                    {
+                        break;
+                    }
+                    best = tuning_result{candidate, gops_per_sec};
+                    moved = true;
+                    improved = true;
+                }
+                // If growing helped, no need to try shrinking
+                if(moved)
+                {
+                    break;
+                }
+            }
+        }
+        if(!improved)
+        {
+            break;
+        }
+    }
+
+    for(auto& [_, shader] : shaders)
+    {
+        shader->destroy_shared_module();
+    }
+
+    return best;
+}
+
+scaling_result coopmat_autotuner::sweep_num_groups(
+        device_context& context,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        std::uint32_t subgroup_size,
+        tuning_parameters tuning,
+        std::uint32_t sweep_inner_iterations,
+        double knee_fraction)
+{
+    shader_map shaders;
+    std::map<std::uint32_t, benchmark_result> measured;
+
+    // 0 if it couldn't be run (most likely the buffers got too big), those aren't kept as points
+    auto measure = [&](std::uint32_t num_groups) -> double
+    {
+        if(auto findit = measured.find(num_groups); findit != measured.end())
+        {
+            return median_gops_per_sec(findit->second);
+        }
+        auto parameters = tuning;
+        parameters.num_groups = num_groups;
+        try
+        {
+            auto result = evaluate(context, cmprops, subgroup_size, parameters, sweep_inner_iterations, shaders);
+            auto gops_per_sec = median_gops_per_sec(result);
+            fmt::print("    Scaling num_groups={:6d}: {:.2f} GOP/s (median)\n", num_groups, gops_per_sec);
+            measured.emplace(num_groups, std::move(result));
+            return gops_per_sec;
+        }
+        catch(const std::runtime_error& e)
+        {
+            fmt::print("    Scaling num_groups={:6d} failed: {}\n", num_groups, e.what());
+            return 0.0;
+        }
+    };
+
+    // Coarse: powers of two until it's clearly past saturation
+    double best = 0.0;
+    std::uint32_t octaves_without_gain = 0;
+    for(std::uint32_t num_groups = 1; num_groups <= max_scaling_groups; num_groups *= 2)
+    {
+        auto gops_per_sec = measure(num_groups);
+        if(gops_per_sec <= 0.0)
+        {
+            break;
+        }
+        if(gops_per_sec > best*(1.0 + margin))
+        {
+            octaves_without_gain = 0;
+        }
+        else if(++octaves_without_gain >= scaling_octaves_past_peak)
+        {
+            break;
+        }
+        best = std::max(best, gops_per_sec);
+    }
+
+    if(measured.empty())
+    {
+        for(auto& [_, shader] : shaders)
+        {
+            shader->destroy_shared_module();
+        }
+        throw std::runtime_error("Scaling sweep couldn't run a single dispatch size");
+    }
+
+    auto find_knee = [&]() -> std::uint32_t
+    {
+        for(const auto& [num_groups, result] : measured)
+        {
+            if(median_gops_per_sec(result) >= knee_fraction*best)
+            {
+                return num_groups;
+            }
+        }
+        return measured.rbegin()->first;
+    };
+
+    // Fine: the knee is somewhere between the last power of two below it and itself
+    auto coarse_knee = find_knee();
+    if(coarse_knee > 1)
+    {
+        const double step = std::exp2(1.0/std::max<std::uint32_t>(scaling_steps_per_octave, 1));
+        for(double num_groups = (coarse_knee/2)*step; num_groups < coarse_knee; num_groups *= step)
+        {
+            best = std::max(best, measure(static_cast<std::uint32_t>(std::round(num_groups))));
+        }
+    }
+
+    scaling_result result
+    {
+        .peak_gops_per_sec = best,
+        .knee_num_groups = find_knee(),
+        .knee_fraction = knee_fraction,
+        .effective_concurrent_subgroups = 0.0,
+    };
+    for(auto& [num_groups, point_result] : measured)
+    {
+        result.points.push_back(scaling_point{num_groups, median_gops_per_sec(point_result), std::move(point_result)});
+    }
+    const double single = result.points.front().gops_per_sec;
+    result.effective_concurrent_subgroups = (single > 0.0) ? best/single : 0.0;
+
+    for(auto& [_, shader] : shaders)
+    {
+        shader->destroy_shared_module();
+    }
+
+    return result;
+}
@@ -0,0 +1,144 @@
+#ifndef COOPMAT_AUTOTUNER
+#define COOPMAT_AUTOTUNER
+
+#include "coopmat_benchmark.hpp"
+#include "coopmat_benchmark_shader.hpp"
+#include "device_context.hpp"
+#include "spirv_cache.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+struct tuning_result
+{
+    tuning_parameters parameters;
+    double gops_per_sec;
+};
+
+struct scaling_point
+{
+    // One subgroup per workgroup, so this is also the number of subgroups dispatched
+    std::uint32_t num_groups;
+    // From the median dispatch time, what the knee and the peak are based on
+    double gops_per_sec;
+    benchmark_result result;
+};
+
+// Throughput against dispatch size, for one configuration
+struct scaling_result
+{
+    // Sorted by num_groups
+    std::vector<scaling_point> points;
+    double peak_gops_per_sec;
+    // Smallest dispatch that reaches knee_fraction of the peak
+    std::uint32_t knee_num_groups;
+    double knee_fraction;
+    // Peak over what a single subgroup gets on its own, i.e. how many subgroups
+    // the device effectively runs at full speed at the same time
+    double effective_concurrent_subgroups;
+};
+
+// Keeps the best known tuning_parameters per (device, driver, M x N x K, A/B/C/D types)
+// Stored as a simple tab separated text file, one entry per line
+class tuning_database
+{
+public:
+    static std::string make_key(
+            std::string_view device_name,
+            std::string_view driver_version,
+            VkCooperativeMatrixPropertiesKHR cmprops);
+
+    void load(const std::filesystem::path& path);
+    void save(const std::filesystem::path& path) const;
+
+    std::optional<tuning_result> find(const std::string& key) const;
+    void update(const std::string& key, tuning_result result);
+
+    auto get_entries() const -> const std::map<std::string, tuning_result>&
+    {
+        return entries;
+    }
+private:
+    std::map<std::string, tuning_result> entries;
+};
+
+class coopmat_autotuner
+{
+public:
+    coopmat_autotuner(
+            std::string_view code_template,
+            double margin,
+            std::uint32_t inner_iterations,
+            std::uint32_t num_repetitions,
+            const spirv_cache* cache = nullptr,
+            const measurement_settings& measurement = {})
+        : code_template(code_template),
+          margin(margin),
+          inner_iterations(inner_iterations),
+          num_repetitions(num_repetitions),
+          cache(cache),
+          measurement(measurement)
+    {}
+
+    // Coordinate search over insts_in_block, blocks_in_kernel and num_groups,
+    // starting at 'start'. Each knob gets doubled (or halved, if doubling doesn't help)
+    // until a step doesn't beat the best configuration by more than 'margin'.
+    // Doubling is clamped to the max_* bounds and stops there
+    tuning_result tune(
+            device_context& context,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            std::uint32_t subgroup_size,
+            tuning_parameters start);
+
+    // Doubles num_groups from 1 until the median throughput has stopped improving by more than 'margin'
+    // for 'scaling_octaves_past_peak' doublings (or max_scaling_groups is hit), then fills in
+    // the octave below the knee with scaling_steps_per_octave steps.
+    // 'sweep_inner_iterations' is the loop count inside the kernel, so it matches the job it belongs to
+    scaling_result sweep_num_groups(
+            device_context& context,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            std::uint32_t subgroup_size,
+            tuning_parameters tuning,
+            std::uint32_t sweep_inner_iterations,
+            double knee_fraction = 0.95);
+
+    // Upper bounds for the search, mostly to keep register usage and buffer sizes sane
+    std::uint32_t max_insts_in_block = 32;
+    std::uint32_t max_blocks_in_kernel = 32;
+    std::uint32_t max_group_factor = 16;
+    std::uint32_t max_passes = 2;
+    std::uint32_t max_scaling_groups = 1u << 16;
+    std::uint32_t scaling_octaves_past_peak = 2;
+    std::uint32_t scaling_steps_per_octave = 8;
+private:
+    using shader_map = std::map<
+        std::pair<std::uint32_t, std::uint32_t>,
+        std::shared_ptr<coopmat_benchmark_shader>>;
+
+    benchmark_result evaluate(
+            device_context& context,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            std::uint32_t subgroup_size,
+            tuning_parameters parameters,
+            std::uint32_t evaluate_inner_iterations,
+            shader_map& shaders);
+
+    std::string code_template;
+    double margin;
+    std::uint32_t inner_iterations;
+    std::uint32_t num_repetitions;
+    const spirv_cache* cache;
+    // Applied to every candidate and scaling point, the same as for the normal jobs
+    measurement_settings measurement;
+};
+
+#endif /* ifndef COOPMAT_AUTOTUNER */
@@ -0,0 +1,95 @@
+#include "coopmat_bandwidth_benchmark.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+coopmat_bandwidth_benchmark::coopmat_bandwidth_benchmark(
+        VkPhysicalDevice phy_device,
+        VkDevice device,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        bandwidth_parameters parameters,
+        std::size_t tiles_per_iteration,
+        std::size_t inner_iterations,
+        std::size_t outer_iterations,
+        std::size_t num_groups)
+    : base_coopmat_benchmark(
+            phy_device,
+            device,
+            cmprops,
+            tiles_per_iteration,
+            inner_iterations,
+            outer_iterations,
+            num_groups),
+      parameters(parameters),
+      element_size(component_type_size(cmprops.AType))
+{
+    if(element_size == 0)
+    {
+        throw std::runtime_error("Unknown component type size");
+    }
+    // Row major: M rows of K elements, column major: K columns of M elements
+    const std::uint32_t line_length = parameters.column_major ? cmprops.MSize : cmprops.KSize;
+    const std::uint32_t line_count = parameters.column_major ? cmprops.KSize : cmprops.MSize;
+    stride = line_length*std::max<std::uint32_t>(parameters.stride_factor, 1);
+    tile_span = std::uint64_t{line_count}*stride;
+
+    // Offsets are 32 bit in the shader
+    const std::uint64_t max_elements = std::numeric_limits<std::uint32_t>::max();
+    working_set_tiles = std::max<std::uint64_t>(1, parameters.working_set_bytes/(tile_span*element_size));
+    working_set_tiles = std::min(working_set_tiles, max_elements/tile_span);
+}
+
+void coopmat_bandwidth_benchmark::create_buffers(const device_context& context)
+{
+    // a is read from, c written to, b isn't used (but still needs an address)
+    base_coopmat_benchmark::create_buffers(context,
+            get_working_set_bytes(),
+            tile_span*element_size,
+            get_working_set_bytes());
+}
+
+std::uint64_t coopmat_bandwidth_benchmark::get_bytes_per_dispatch(std::uint32_t) const
+{
+    // Only the bytes of the tiles count, not what's skipped over with larger strides
+    std::uint64_t tile_bytes = std::uint64_t{cmprops.MSize}*cmprops.KSize*element_size;
+    std::uint64_t bytes = std::uint64_t{num_groups}*inner_iterations*insts_in_block*tile_bytes;
+    return (parameters.mode == bandwidth_mode::copy) ? 2*bytes : bytes;
+}
+
+coopmat_benchmark_shader::macro_list coopmat_bandwidth_benchmark::make_macros(std::uint32_t subgroup_size) const
+{
+    using pss = std::pair<std::string, std::string>;
+
+    std::string mode_macro;
+    switch(parameters.mode)
+    {
+        case bandwidth_mode::load: mode_macro = "MODE_LOAD"; break;
+        case bandwidth_mode::store: mode_macro = "MODE_STORE"; break;
+        case bandwidth_mode::copy: mode_macro = "MODE_COPY"; break;
+    }
+
+    return coopmat_benchmark_shader::macro_list
+    {
+        pss{"A_TYPE", component_type_to_glsl_type_str(cmprops.AType)},
+        pss{"SUBGRP_SIZE", fmt::format("{}", subgroup_size)},
+        pss{mode_macro, "1"},
+        pss{"LAYOUT", parameters.column_major ? "gl_CooperativeMatrixLayoutColumnMajor" : "gl_CooperativeMatrixLayoutRowMajor"},
+        pss{"STRIDE", fmt::format("{}u", stride)},
+        pss{"TILE_SPAN", fmt::format("{}u", tile_span)},
+        pss{"WORKING_SET_TILES", fmt::format("{}u", working_set_tiles)},
+        pss{"TILES_PER_ITER", fmt::format("{}", insts_in_block)},
+    };
+}
+
+std::string coopmat_bandwidth_benchmark::get_name() const
+{
+    return fmt::format("bandwidth-{}-{}-s{}-ws{}",
+            bandwidth_mode_to_str(parameters.mode),
+            parameters.column_major ? "col" : "row",
+            std::max<std::uint32_t>(parameters.stride_factor, 1),
+            get_working_set_bytes());
+}
@@ -0,0 +1,83 @@
+#ifndef COOPMAT_BANDWIDTH_BENCHMARK
+#define COOPMAT_BANDWIDTH_BENCHMARK
+
+#include "coopmat_benchmark.hpp"
+#include "coopmat_benchmark_shader.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+enum class bandwidth_mode
+{
+    load,
+    store,
+    copy,
+};
+
+constexpr std::string_view bandwidth_mode_to_str(bandwidth_mode mode)
+{
+    switch(mode)
+    {
+        case bandwidth_mode::load: return "load";
+        case bandwidth_mode::store: return "store";
+        case bandwidth_mode::copy: return "copy";
+    }
+    return "unknown";
+}
+
+struct bandwidth_parameters
+{
+    bandwidth_mode mode;
+    bool column_major;
+    // Distance between rows/columns in elements, in multiples of the tight one (K for row major, M for column major)
+    std::uint32_t stride_factor;
+    // Requested size of the memory the dispatch cycles through, rounded down to whole tiles
+    std::uint64_t working_set_bytes;
+};
+
+// Measures how fast coopMatLoad/coopMatStore stream M x K tiles of the A type
+// from/to memory, using coopmat_bandwidth.comp.glsl.in.
+// insts_in_block is the number of tiles per subgroup and loop iteration
+class coopmat_bandwidth_benchmark : public base_coopmat_benchmark
+{
+public:
+    coopmat_bandwidth_benchmark(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            bandwidth_parameters parameters,
+            std::size_t tiles_per_iteration,
+            std::size_t inner_iterations,
+            std::size_t outer_iterations,
+            std::size_t num_groups);
+    virtual ~coopmat_bandwidth_benchmark() = default;
+
+    virtual void create_buffers(const device_context& context);
+
+    virtual std::uint64_t get_ops_per_dispatch(std::uint32_t) const
+    {
+        return 0;
+    }
+    virtual std::uint64_t get_bytes_per_dispatch(std::uint32_t blocks_in_kernel) const;
+
+    coopmat_benchmark_shader::macro_list make_macros(std::uint32_t subgroup_size) const;
+
+    // e.g. "bandwidth-copy-col-s2-ws1048576", for the result records
+    std::string get_name() const;
+
+    auto get_working_set_bytes() const -> std::uint64_t
+    {
+        return working_set_tiles*tile_span*element_size;
+    }
+private:
+    bandwidth_parameters parameters;
+    std::uint32_t element_size;
+    std::uint32_t stride;
+    std::uint64_t tile_span;
+    std::uint64_t working_set_tiles;
+};
+
+#endif /* ifndef COOPMAT_BANDWIDTH_BENCHMARK */
@@ -4,9 +4,59 @@
 #include <vulkan/vk_enum_string_helper.h>
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <span>
+#include <stdexcept>
+#include <utility>
 
-void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t b_type_size, std::size_t c_type_size)
+namespace
 {
+    // Some drivers return VK_TIMEOUT/VK_NOT_READY even with an infinite timeout, just wait again.
+    // The fence is reset afterwards, so it can go straight into the next submit
+    void wait_fence(VkDevice device, VkFence fence)
+    {
+        VkResult result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        while((result == VK_TIMEOUT) || (result == VK_NOT_READY))
+        {
+            fmt::print("Timed out, waiting again\n");
+            result = vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
+        }
+        if(VK_SUCCESS != result)
+        {
+            fmt::print("Error waiting for fence: {}\n", string_VkResult(result));
+            throw std::runtime_error("Failed waiting for fence");
+        }
+        vkResetFences(device, 1, &fence);
+    }
+
+    void print_latency_histogram(const latency_histogram& histogram)
+    {
+        constexpr std::size_t bar_width = 40;
+        auto largest = std::max_element(histogram.counts.begin(), histogram.counts.end());
+        if(largest == histogram.counts.end() || *largest == 0)
+        {
+            return;
+        }
+        for(std::size_t i = 0; i < histogram.counts.size(); i++)
+        {
+            auto count = histogram.counts[i];
+            // Non-empty buckets always get at least one '#', so the tail stays visible
+            auto bar = (count == 0) ? 0 : std::max<std::size_t>(1, count*bar_width / *largest);
+            fmt::print("    {:>10.0f} - {:>10.0f} ns {:>7} {}\n",
+                    histogram.edges[i], histogram.edges[i+1], count, std::string(bar, '#'));
+        }
+    }
+}
+
+void base_coopmat_benchmark::create_buffers(const device_context& context, std::size_t a_bytes, std::size_t b_bytes, std::size_t c_bytes)
+{
+    a_size = a_bytes;
+    b_size = b_bytes;
+    c_size = c_bytes;
+
     VkBufferCreateInfo bci
     {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -17,8 +67,27 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
                  VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT_KHR,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
+    // run_multi_queue() uses the buffers from every compute queue at once, the transfer
+    // benchmark copies to them on the transfer queue while a kernel runs, and those can be
+    // in different families. Exclusive buffers would need ownership transfers between them
+    std::vector<std::uint32_t> families;
+    const auto queue_count = context.get_queue_count() + (context.get_transfer_queue_index() ? 1 : 0);
+    for(std::size_t q = 0; q < queue_count; q++)
+    {
+        auto family = context.get_queue_family_index(q);
+        if(std::find(families.begin(), families.end(), family) == families.end())
+        {
+            families.push_back(family);
+        }
+    }
+    if(families.size() > 1)
+    {
+        bci.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bci.queueFamilyIndexCount = static_cast<std::uint32_t>(families.size());
+        bci.pQueueFamilyIndices = families.data();
+    }
 
-    bci.size  = (num_groups)*a_type_size*cmprops.MSize*cmprops.KSize;
+    bci.size  = a_bytes;
     auto ret = vkCreateBuffer(device, &bci, nullptr, &a_buffer);
     if (ret != VK_SUCCESS)
     {
@@ -30,7 +99,7 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
         throw std::runtime_error("Error creating a buffer");
     }
 
-    bci.size  = (num_groups)*b_type_size*cmprops.KSize*cmprops.NSize;
+    bci.size  = b_bytes;
     ret = vkCreateBuffer(device, &bci, nullptr, &b_buffer);
     if (ret != VK_SUCCESS)
     {
@@ -42,7 +111,7 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
         throw std::runtime_error("Error creating b buffer");
     }
 
-    bci.size  = (num_groups)*c_type_size*cmprops.MSize*cmprops.KSize*insts_in_block;
+    bci.size  = c_bytes;
     ret = vkCreateBuffer(device, &bci, nullptr, &c_buffer);
     if (ret != VK_SUCCESS)
     {
@@ -54,11 +123,15 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
         throw std::runtime_error("Error creating c buffer");
     }
 
-    bci.size = 3*sizeof(VkDeviceAddress);
-    ret = vkCreateBuffer(device, &bci, nullptr, &devptr_buffer);
-    if (ret != VK_SUCCESS)
+    const bool use_descriptor = (context.get_configuration().binding == address_binding::descriptor);
+    if(use_descriptor)
     {
-        throw std::runtime_error("Error creating dev ptr buffer");
+        bci.size = 3*sizeof(VkDeviceAddress);
+        ret = vkCreateBuffer(device, &bci, nullptr, &devptr_buffer);
+        if (ret != VK_SUCCESS)
+        {
+            throw std::runtime_error("Error creating dev ptr buffer");
+        }
     }
 
     a_mem_reqs.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
@@ -74,107 +147,56 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
     vkGetBufferMemoryRequirements2(device, &bmri, &b_mem_reqs);
     bmri.buffer = c_buffer;
     vkGetBufferMemoryRequirements2(device, &bmri, &c_mem_reqs);
-    bmri.buffer = devptr_buffer;
-    vkGetBufferMemoryRequirements2(device, &bmri, &devptr_mem_reqs);
-
-    VkPhysicalDeviceMemoryProperties2 pdmp{};
-    pdmp.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
-    vkGetPhysicalDeviceMemoryProperties2(phy_device, &pdmp);
-
-    auto a_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            a_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    auto a_host_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            a_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    auto b_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            b_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    auto b_host_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            b_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    auto c_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            c_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    auto c_host_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            c_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-    auto devptr_host_heap_idx = vk_find_memory_type(
-            &pdmp.memoryProperties,
-            devptr_mem_reqs.memoryRequirements.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    if(a_heap_idx != b_heap_idx || b_heap_idx != c_heap_idx)
-    {
-        throw std::runtime_error("Got different heaps for matrix buffers");
-    }
-    if(a_host_heap_idx != b_host_heap_idx || b_host_heap_idx != c_host_heap_idx)
-    {
-        throw std::runtime_error("Got different heaps for matrix buffers");
-    }
-
-    VkMemoryAllocateFlagsInfo mafi
-    {
-        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
-    };
+    if(use_descriptor)
+    {
+        bmri.buffer = devptr_buffer;
+        vkGetBufferMemoryRequirements2(device, &bmri, &devptr_mem_reqs);
+    }
 
-    
-    VkMemoryAllocateInfo mai{};
-    mai.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    mai.pNext = &mafi;
-    mai.allocationSize = a_mem_reqs.memoryRequirements.size +
-                         b_mem_reqs.memoryRequirements.size +
-                         c_mem_reqs.memoryRequirements.size;
-    mai.memoryTypeIndex = a_heap_idx;
-    
-    vkAllocateMemory(device, &mai, nullptr, &dev_memory);
-    mai.memoryTypeIndex = a_host_heap_idx;
-    vkAllocateMemory(device, &mai, nullptr, &host_memory);
-    mai.allocationSize = devptr_mem_reqs.memoryRequirements.size;
-    mai.memoryTypeIndex = devptr_host_heap_idx;
-    vkAllocateMemory(device, &mai, nullptr, &devptr_memory);
-
-    std::vector<VkBindBufferMemoryInfo> bbmis(4);
-    for(auto & bbmi : bbmis)
-    {
-        bbmi.sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO;
-        bbmi.memory = dev_memory;
-    }
-    bbmis[0].buffer = a_buffer;
-    bbmis[0].memoryOffset = 0;
-    bbmis[1].buffer = b_buffer;
-    bbmis[1].memoryOffset = a_mem_reqs.memoryRequirements.size;
-    bbmis[2].buffer = c_buffer;
-    bbmis[2].memoryOffset = a_mem_reqs.memoryRequirements.size +
-                            b_mem_reqs.memoryRequirements.size;
-    bbmis[3].memory = devptr_memory;
-    bbmis[3].memoryOffset = 0;
-    bbmis[3].buffer = devptr_buffer;
-    vkBindBufferMemory2(device, bbmis.size(), bbmis.data());
-    for(auto& bbmi : bbmis)
-    {
-        bbmi.memory = host_memory;
-    }
-    bbmis[0].buffer = a_host_buffer;
-    bbmis[1].buffer = b_host_buffer;
-    bbmis[2].buffer = c_host_buffer;
-    vkBindBufferMemory2(device, bbmis.size()-1, bbmis.data());
+    // Every buffer gets its own range from the device's arena, so they don't have to
+    // share a memory type and nothing is allocated from the driver once the arena is warm.
+    // Host buffers would like to be cached, but any host visible and coherent memory will do
+    arena = &context.get_memory_arena();
+    constexpr VkMemoryPropertyFlags host_required =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    constexpr VkMemoryPropertyFlags host_preferred = host_required | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
 
+    a_memory = arena->allocate(a_mem_reqs.memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    b_memory = arena->allocate(b_mem_reqs.memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    c_memory = arena->allocate(c_mem_reqs.memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0);
+    // Same create info as the device buffers, so same requirements
+    a_host_memory = arena->allocate(a_mem_reqs.memoryRequirements, host_preferred, host_required);
+    b_host_memory = arena->allocate(b_mem_reqs.memoryRequirements, host_preferred, host_required);
+    c_host_memory = arena->allocate(c_mem_reqs.memoryRequirements, host_preferred, host_required);
+
+    std::vector<std::pair<VkBuffer, const memory_arena::allocation*>> bindings
+    {
+        {a_buffer, &a_memory},
+        {b_buffer, &b_memory},
+        {c_buffer, &c_memory},
+        {a_host_buffer, &a_host_memory},
+        {b_host_buffer, &b_host_memory},
+        {c_host_buffer, &c_host_memory},
+    };
+    if(use_descriptor)
+    {
+        devptr_memory = arena->allocate(devptr_mem_reqs.memoryRequirements, host_preferred, host_required);
+        bindings.emplace_back(devptr_buffer, &devptr_memory);
+    }
+    std::vector<VkBindBufferMemoryInfo> bbmis;
+    for(auto [buffer, range] : bindings)
+    {
+        bbmis.push_back(VkBindBufferMemoryInfo{
+                .sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO,
+                .buffer = buffer,
+                .memory = range->memory,
+                .memoryOffset = range->offset});
+    }
+    if(VK_SUCCESS != vkBindBufferMemory2(device, bbmis.size(), bbmis.data()))
+    {
+        throw std::runtime_error("Failed to bind buffer memory");
+    }
 
     PFN_vkGetBufferDeviceAddress _vkGetBufferDeviceAddress =
         reinterpret_cast<PFN_vkGetBufferDeviceAddress>(
@@ -190,54 +212,51 @@ void base_coopmat_benchmark::create_buffers(std::size_t a_type_size, std::size_t
         .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
         .buffer = a_buffer
     };
-    auto a_devptr = _vkGetBufferDeviceAddress(device, &bdai);
+    a_address = _vkGetBufferDeviceAddress(device, &bdai);
     bdai.buffer = b_buffer;
-    auto b_devptr = _vkGetBufferDeviceAddress(device, &bdai);
+    b_address = _vkGetBufferDeviceAddress(device, &bdai);
     bdai.buffer = c_buffer;
-    auto c_devptr = _vkGetBufferDeviceAddress(device, &bdai);
-
-    VkDeviceAddress* devptr_ptr;
-
-
-    vkMapMemory(device, devptr_memory,
-            0, devptr_mem_reqs.memoryRequirements.size,
-            0, reinterpret_cast<void**>(&devptr_ptr));
+    c_address = _vkGetBufferDeviceAddress(device, &bdai);
 
-    devptr_ptr[0] = a_devptr;
-    devptr_ptr[1] = b_devptr;
-    devptr_ptr[2] = c_devptr;
-
-    vkUnmapMemory(device, devptr_memory);
+    if(use_descriptor)
+    {
+        // Persistently mapped by the arena
+        auto devptr_ptr = reinterpret_cast<VkDeviceAddress*>(devptr_memory.mapped);
+        devptr_ptr[0] = a_address;
+        devptr_ptr[1] = b_address;
+        devptr_ptr[2] = c_address;
+    }
 }
 
+// Also cleans up after a create_buffers() that threw half way
 void base_coopmat_benchmark::destroy_buffers()
 {
-    vkDestroyBuffer(device, a_buffer, nullptr);
-    vkDestroyBuffer(device, b_buffer, nullptr);
-    vkDestroyBuffer(device, c_buffer, nullptr);
-    vkDestroyBuffer(device, devptr_buffer, nullptr);
-    vkDestroyBuffer(device, a_host_buffer, nullptr);
-    vkDestroyBuffer(device, b_host_buffer, nullptr);
-    vkDestroyBuffer(device, c_host_buffer, nullptr);
-
-    vkFreeMemory(device, dev_memory, nullptr);
-    vkFreeMemory(device, host_memory, nullptr);
-    vkFreeMemory(device, devptr_memory, nullptr);
+    for(auto* buffer : {&a_buffer, &b_buffer, &c_buffer, &devptr_buffer,
+                        &a_host_buffer, &b_host_buffer, &c_host_buffer})
+    {
+        vkDestroyBuffer(device, *buffer, nullptr);
+        *buffer = VK_NULL_HANDLE;
+    }
+
+    // Back to the arena for the next benchmark
+    for(auto* range : {&a_memory, &b_memory, &c_memory,
+                       &a_host_memory, &b_host_memory, &c_host_memory, &devptr_memory})
+    {
+        if(arena)
+        {
+            arena->free(*range);
+        }
+        *range = memory_arena::allocation{};
+    }
 }
 
-void base_coopmat_benchmark::run(
-        coopmat_benchmark_shader::configuration config,
-        VkQueue queue,
-        VkCommandBuffer command_buffer,
-	std::uint32_t blocks_in_kernel)
+void base_coopmat_benchmark::update_descriptors(const coopmat_benchmark_shader::configuration& config)
 {
-    shader->finalize(cmprops, config);
-
-    VkCommandBufferBeginInfo cbbi 
+    // Nothing to update, bind_kernel pushes the addresses with every recording
+    if(config.binding == address_binding::push_constant)
     {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-    };
-
+        return;
+    }
 
     VkDescriptorBufferInfo dbi
     {
@@ -260,97 +279,819 @@ void base_coopmat_benchmark::run(
     };
 
     vkUpdateDescriptorSets(device, 1, &wds, 0, nullptr);
+}
 
-    std::vector<std::uint64_t> timestamps(2*outer_iterations);
-
-    VkQueryPoolCreateInfo qpci
+void base_coopmat_benchmark::bind_kernel(
+        VkCommandBuffer command_buffer,
+        const coopmat_benchmark_shader::configuration& config,
+        std::uint32_t n)
+{
+    if(config.binding == address_binding::push_constant)
     {
-        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
-        .queryType = VK_QUERY_TYPE_TIMESTAMP,
-        .queryCount = static_cast<std::uint32_t>(timestamps.size()),
-    };
+        push_parameters parameters
+        {
+            .n = n,
+            .padding = 0,
+            .a = a_address,
+            .b = b_address,
+            .c = c_address,
+        };
+        vkCmdPushConstants(command_buffer, config.pl, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(parameters), &parameters);
+    }
+    else
+    {
+        vkCmdPushConstants(command_buffer, config.pl, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(std::uint32_t), &n);
+        vkCmdBindDescriptorSets(command_buffer,
+                VK_PIPELINE_BIND_POINT_COMPUTE, config.pl,
+                0u, 1, &config.ds, 0, nullptr);
+    }
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+            shader->get_pipeline());
+}
 
-    VkQueryPool query_pool;
-    vkCreateQueryPool(device, &qpci, nullptr, &query_pool);
+void base_coopmat_benchmark::run_validation_dispatch(device_context& context)
+{
+    const auto& config = context.get_configuration();
+    auto queue = context.get_queue();
+    auto command_buffer = context.get_command_buffer();
 
+    update_descriptors(config);
 
-    std::uint32_t gpu_n = static_cast<std::uint32_t>(inner_iterations);
+    VkCommandBufferBeginInfo cbbi
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
     vkBeginCommandBuffer(command_buffer, &cbbi);
-    vkCmdResetQueryPool(command_buffer, query_pool, 0, timestamps.size());
-    vkCmdPushConstants(command_buffer, config.pl, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(std::uint32_t), &gpu_n);
-    vkCmdBindDescriptorSets(command_buffer,
-            VK_PIPELINE_BIND_POINT_COMPUTE, config.pl, 
-            0u, 1, &config.ds, 0, nullptr);
-    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
-            shader->get_pipeline());
-    for(std::size_t i = 0; i < outer_iterations; i++)
+
+    VkBufferCopy region{ .srcOffset = 0, .dstOffset = 0, .size = a_size };
+    vkCmdCopyBuffer(command_buffer, a_host_buffer, a_buffer, 1, &region);
+    region.size = b_size;
+    vkCmdCopyBuffer(command_buffer, b_host_buffer, b_buffer, 1, &region);
+    region.size = c_size;
+    vkCmdCopyBuffer(command_buffer, c_host_buffer, c_buffer, 1, &region);
+
+    VkMemoryBarrier mb
     {
-        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool, i*2+0);
-        vkCmdDispatch(command_buffer, num_groups, 1, 1);
-        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i*2+1);
-    }
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+    };
+    vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    // n = 1, so the reference only has to repeat blocks_in_kernel times
+    std::uint32_t gpu_n = 1;
+    bind_kernel(command_buffer, config, gpu_n);
+    vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+
+    mb.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 1, &mb, 0, nullptr, 0, nullptr);
+
+    vkCmdCopyBuffer(command_buffer, c_buffer, c_host_buffer, 1, &region);
+
+    mb.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    mb.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer,
+            VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+            0, 1, &mb, 0, nullptr, 0, nullptr);
     vkEndCommandBuffer(command_buffer);
+
     VkSubmitInfo si
     {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
         .commandBufferCount = 1,
         .pCommandBuffers = &command_buffer,
     };
-    if (VK_SUCCESS != vkQueueSubmit(queue, 1, &si, VK_NULL_HANDLE))
+    VkFenceCreateInfo fci
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    VkFence fence;
+    if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+    {
+        throw std::runtime_error("Failed to create fence");
+    }
+    try
     {
-        throw std::runtime_error("Failed submitting command buffer to queue");
+        if (VK_SUCCESS != vkQueueSubmit(queue, 1, &si, fence))
+        {
+            throw std::runtime_error("Failed submitting command buffer to queue");
+        }
+        wait_fence(device, fence);
     }
-    VkResult result = vkQueueWaitIdle(queue);
-    // AMD windows driver will return VK_TIMEOUT, AMDGPU pro on linux will return VK_NOT_READY
-    // I think neither are to spec, as the spec states that you can only either get VK_SUCCESS
-    // or some VK_ERROR_* as a return value
-    while((result == VK_TIMEOUT) || (result == VK_NOT_READY))
+    catch(...)
     {
-        fmt::print("Timed out, waiting again\n");
-        result = vkQueueWaitIdle(queue);
+        vkDeviceWaitIdle(device);
+        vkDestroyFence(device, fence, nullptr);
+        throw;
     }
-    if (VK_SUCCESS != result)
+    vkDestroyFence(device, fence, nullptr);
+}
+
+benchmark_result base_coopmat_benchmark::run(
+        device_context& context,
+        std::uint32_t blocks_in_kernel)
+{
+    const auto& config = context.get_configuration();
+    auto queue = context.get_queue();
+
+    // Pipelines are normally created up front in batches, but the tuner doesn't do that
+    if(VK_NULL_HANDLE == shader->get_pipeline())
     {
-        fmt::print("Error waiting for queue: {}\n",string_VkResult(result));
-        throw std::runtime_error("Failed waiting until queue idle");
+        shader->finalize(cmprops, config);
     }
+    fmt::print("Pipeline created in {:.3f} ms (cache {})\n",
+            shader->get_creation_nanoseconds()*1e-6,
+            shader->get_creation_cache_hit() ? "hit" : "miss");
+
+    VkCommandBufferBeginInfo cbbi 
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    };
+
+
+    update_descriptors(config);
 
-    vkGetQueryPoolResults(device, query_pool, 0, timestamps.size(), timestamps.size()*sizeof(std::uint64_t), timestamps.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    const auto timestamp_period = context.get_timestamp_period();
 
-    vkDestroyQueryPool(device, query_pool, nullptr);
+    // One batch is outer_iterations dispatches, we keep submitting batches until
+    // the median is known well enough (or we run out of time/repetitions)
+    // Warm-up batches go through the same query pool, they are just thrown away.
+    // Two batches can be in flight, each with its own command buffer, fence and half of
+    // the query pool, so the next one is recorded and queued while the GPU runs the current one
+    // and the timestamps of a batch are only read once its fence says it's done
+    constexpr std::size_t slot_count = 2;
+    const std::size_t slot_queries = 2*std::max<std::size_t>(outer_iterations, measurement.warmup_batch);
+    std::vector<std::uint64_t> batch_timestamps(slot_queries);
+    std::vector<std::uint64_t> timestamps;
+    std::vector<double> durations;
 
-    std::uint64_t min_duration = timestamps[1] - timestamps[0];
-    std::uint64_t avg_duration = 0;
-    for(std::size_t i = 0; i < outer_iterations; i++)
+    VkQueryPoolCreateInfo qpci
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = static_cast<std::uint32_t>(slot_count*slot_queries),
+    };
+
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    std::array<VkFence, slot_count> fences{};
+    auto destroy_objects = [&]()
+    {
+        for(auto fence : fences)
+        {
+            vkDestroyFence(device, fence, nullptr);
+        }
+        vkDestroyQueryPool(device, query_pool, nullptr);
+    };
+    if(VK_SUCCESS != vkCreateQueryPool(device, &qpci, nullptr, &query_pool))
     {
-        std::uint64_t duration = timestamps[2*i+1] - timestamps[2*i+0];
-        min_duration = std::min(duration, min_duration);
-        avg_duration  += duration;
+        throw std::runtime_error("Failed to create query pool");
     }
-    avg_duration /= outer_iterations;
+    VkFenceCreateInfo fci
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    for(auto& fence : fences)
+    {
+        if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+        {
+            destroy_objects();
+            throw std::runtime_error("Failed to create fence");
+        }
+    }
+
+    // (slot, dispatches) of the submitted batches, oldest first
+    std::deque<std::pair<std::size_t, std::size_t>> in_flight;
+    std::size_t next_slot = 0;
+
+    // Records and submits 'count' timestamped dispatches into the next free slot
+    auto launch_batch = [&](std::size_t count)
+    {
+        const auto slot = next_slot;
+        next_slot = (next_slot + 1) % slot_count;
+        const auto first_query = static_cast<std::uint32_t>(slot*slot_queries);
+
+        std::uint32_t gpu_n = static_cast<std::uint32_t>(inner_iterations);
+        auto command_buffer = context.get_command_buffer(slot);
+        vkBeginCommandBuffer(command_buffer, &cbbi);
+        vkCmdResetQueryPool(command_buffer, query_pool, first_query, 2*count);
+        bind_kernel(command_buffer, config, gpu_n);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, query_pool, first_query + i*2+0);
+            vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, first_query + i*2+1);
+        }
+        vkEndCommandBuffer(command_buffer);
+        VkSubmitInfo si
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &command_buffer,
+        };
+        if (VK_SUCCESS != vkQueueSubmit(queue, 1, &si, fences[slot]))
+        {
+            throw std::runtime_error("Failed submitting command buffer to queue");
+        }
+        in_flight.emplace_back(slot, count);
+    };
+
+    // Waits for the oldest batch, leaves its raw timestamps in batch_timestamps
+    // and returns its durations in ns
+    auto retire_batch = [&]() -> std::vector<double>
+    {
+        auto [slot, count] = in_flight.front();
+        in_flight.pop_front();
+        wait_fence(device, fences[slot]);
+
+        vkGetQueryPoolResults(device, query_pool, slot*slot_queries, 2*count, 2*count*sizeof(std::uint64_t), batch_timestamps.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT);
+
+        std::vector<double> batch_durations(count);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            std::uint64_t duration = batch_timestamps[2*i+1] - batch_timestamps[2*i+0];
+            batch_durations[i] = static_cast<double>(duration)*timestamp_period;
+        }
+        return batch_durations;
+    };
+
+    // Clocks ramping up and first-touch page faults show up in the first few dispatches,
+    // so run until the medians of two successive warm-up batches are within warmup_threshold
+    std::uint32_t warmup_iterations = 0;
+    std::uint32_t warmup_launched = 0;
+    bool warmup_settled = (measurement.max_warmup_iterations == 0);
+    auto launch_warmup = [&]()
+    {
+        if(warmup_launched >= measurement.max_warmup_iterations)
+        {
+            return;
+        }
+        auto count = std::min<std::size_t>(std::max<std::uint32_t>(measurement.warmup_batch, 1),
+                measurement.max_warmup_iterations - warmup_launched);
+        launch_batch(count);
+        warmup_launched += count;
+    };
+
+    timing_statistics stats;
+    // The bootstrap in there is O(resamples*samples), redoing it after every batch made the host
+    // the bottleneck of long adaptive runs. So it's only redone once the samples grew by a quarter
+    // (which keeps the total cost within a small factor of a single run over all of them),
+    // and once more at the end if the last batches weren't included
+    std::size_t statistics_samples = 0;
+    auto update_statistics = [&]()
+    {
+        stats = compute_timing_statistics(durations, measurement.statistics);
+        statistics_samples = durations.size();
+    };
+    auto measure_start = std::chrono::steady_clock::now();
+    try
+    {
+        double previous_median = 0.0;
+        if(!warmup_settled)
+        {
+            launch_warmup();
+            launch_warmup();
+        }
+        while(!warmup_settled && !in_flight.empty())
+        {
+            auto batch_durations = retire_batch();
+            warmup_iterations += batch_durations.size();
+
+            std::sort(batch_durations.begin(), batch_durations.end());
+            double median = batch_durations[batch_durations.size()/2];
+            warmup_settled = (previous_median > 0.0) &&
+                (std::abs(median - previous_median) <= measurement.warmup_threshold*previous_median);
+            previous_median = median;
+            if(!warmup_settled)
+            {
+                launch_warmup();
+            }
+        }
+        // Whatever was queued behind the batch that settled it is just more warm-up
+        while(!in_flight.empty())
+        {
+            warmup_iterations += retire_batch().size();
+        }
+        fmt::print("Warm-up: {} dispatches{}\n", warmup_iterations,
+                warmup_settled ? "" : " (timings did not settle)");
+
+        measure_start = std::chrono::steady_clock::now();
+        launch_batch(outer_iterations);
+        while(true)
+        {
+            // No tolerance means the old behaviour: exactly outer_iterations dispatches.
+            // Otherwise the next batch goes out before we know whether we need it, so the GPU
+            // never waits for the statistics. If it turns out we didn't, it's thrown away
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - measure_start;
+            if(measurement.ci_tolerance > 0.0 &&
+               durations.size() + 2*outer_iterations <= measurement.max_repetitions &&
+               elapsed.count() < measurement.time_budget_seconds)
+            {
+                launch_batch(outer_iterations);
+            }
+
+            auto batch_durations = retire_batch();
+            timestamps.insert(timestamps.end(), batch_timestamps.begin(), batch_timestamps.begin() + 2*outer_iterations);
+            durations.insert(durations.end(), batch_durations.begin(), batch_durations.end());
 
-    // TODO: should have been cached somewhere
-    VkPhysicalDeviceProperties phy_dev_props;
-    vkGetPhysicalDeviceProperties(phy_device, &phy_dev_props);
+            if(measurement.ci_tolerance <= 0.0)
+            {
+                break;
+            }
+            if(durations.size() >= statistics_samples + statistics_samples/4)
+            {
+                update_statistics();
+                if(stats.relative_ci_half_width() <= measurement.ci_tolerance)
+                {
+                    break;
+                }
+            }
+            elapsed = std::chrono::steady_clock::now() - measure_start;
+            if(elapsed.count() >= measurement.time_budget_seconds)
+            {
+                update_statistics();
+                fmt::print("Time budget exhausted with CI +-{:.2f}% after {} repetitions\n",
+                        100.0*stats.relative_ci_half_width(), durations.size());
+                break;
+            }
+            if(durations.size() + outer_iterations > measurement.max_repetitions)
+            {
+                update_statistics();
+                fmt::print("Repetition limit reached with CI +-{:.2f}% after {} repetitions\n",
+                        100.0*stats.relative_ci_half_width(), durations.size());
+                break;
+            }
+            if(in_flight.empty())
+            {
+                launch_batch(outer_iterations);
+            }
+        }
+        while(!in_flight.empty())
+        {
+            retire_batch();
+        }
+        if(statistics_samples != durations.size())
+        {
+            update_statistics();
+        }
+    }
+    catch(...)
+    {
+        // Don't destroy anything that might still be in flight
+        vkDeviceWaitIdle(device);
+        destroy_objects();
+        throw;
+    }
 
-    auto min_nanoseconds = min_duration * phy_dev_props.limits.timestampPeriod;
-    auto avg_nanoseconds = avg_duration * phy_dev_props.limits.timestampPeriod;
+    destroy_objects();
 
-    auto ops = num_groups*inner_iterations*(cmprops.MSize*cmprops.NSize*cmprops.KSize*2)*insts_in_block*blocks_in_kernel;
-    auto max_gops_per_sec = static_cast<double>(ops)/static_cast<double>(min_nanoseconds);
-    auto avg_gops_per_sec = static_cast<double>(ops)/static_cast<double>(avg_nanoseconds);
-    fmt::print("Took Min. {} ns\n", min_nanoseconds);
-    fmt::print("Took Avg. {} ns\n", avg_nanoseconds);
+    auto ops = get_ops_per_dispatch(blocks_in_kernel);
+    auto bytes = get_bytes_per_dispatch(blocks_in_kernel);
+    auto gops_per_sec = [ops](double nanoseconds)
+    {
+        return static_cast<double>(ops)/nanoseconds;
+    };
+    // Min. and Avg. over every sample, the median and everything after it without the outliers
+    auto min_nanoseconds = stats.raw_min;
+    auto avg_nanoseconds = stats.raw_mean;
+    auto max_gops_per_sec = gops_per_sec(min_nanoseconds);
+    auto avg_gops_per_sec = gops_per_sec(avg_nanoseconds);
+    fmt::print("Took Min. {:.0f} ns\n", min_nanoseconds);
+    fmt::print("Took Avg. {:.0f} ns\n", avg_nanoseconds);
+    fmt::print("Took Med. {:.0f} ns ({:.0f}% CI: {:.0f} - {:.0f} ns)\n",
+            stats.median, 100.0*measurement.statistics.confidence, stats.ci_low, stats.ci_high);
+    fmt::print("     p5 {:.0f} ns, p95 {:.0f} ns, p99 {:.0f} ns, stddev {:.0f} ns, CV {:.2f}%\n",
+            stats.p5, stats.p95, stats.p99, stats.stddev, 100.0*stats.cv);
+    fmt::print("     {} repetitions, {} outliers rejected\n", durations.size(), stats.outliers);
     std::string op_prefix = "I";
-    if( (cmprops.CType == VK_COMPONENT_TYPE_FLOAT64_KHR ) ||
-        (cmprops.CType == VK_COMPONENT_TYPE_FLOAT32_KHR ) ||
-        (cmprops.CType == VK_COMPONENT_TYPE_FLOAT16_KHR ))
+    if( (cmprops.ResultType == VK_COMPONENT_TYPE_FLOAT64_KHR ) ||
+        (cmprops.ResultType == VK_COMPONENT_TYPE_FLOAT32_KHR ) ||
+        (cmprops.ResultType == VK_COMPONENT_TYPE_FLOAT16_KHR ))
     {
         op_prefix = "FL";
     }
-    fmt::print("Max. {:.2f} G{}OP/s\n", max_gops_per_sec, op_prefix);
-    fmt::print("Avg. {:.2f} G{}OP/s\n", avg_gops_per_sec, op_prefix);
+    if(ops > 0)
+    {
+        fmt::print("Max. {:.2f} G{}OP/s\n", max_gops_per_sec, op_prefix);
+        fmt::print("Avg. {:.2f} G{}OP/s\n", avg_gops_per_sec, op_prefix);
+        fmt::print("Med. {:.2f} G{}OP/s\n", gops_per_sec(stats.median), op_prefix);
+    }
+    if(bytes > 0)
+    {
+        // bytes/ns == GB/s
+        fmt::print("Max. {:.2f} GB/s\n", static_cast<double>(bytes)/min_nanoseconds);
+        fmt::print("Avg. {:.2f} GB/s\n", static_cast<double>(bytes)/avg_nanoseconds);
+        fmt::print("Med. {:.2f} GB/s\n", static_cast<double>(bytes)/stats.median);
+    }
 
+    return benchmark_result
+    {
+        .min_nanoseconds = min_nanoseconds,
+        .avg_nanoseconds = avg_nanoseconds,
+        .max_gops_per_sec = max_gops_per_sec,
+        .avg_gops_per_sec = avg_gops_per_sec,
+        .pipeline_creation_nanoseconds = shader->get_creation_nanoseconds(),
+        .pipeline_cache_hit = shader->get_creation_cache_hit(),
+        .timestamps = std::move(timestamps),
+        .timestamp_period = timestamp_period,
+        .ops = ops,
+        .bytes = bytes,
+        .statistics = stats,
+        .warmup_iterations = warmup_iterations,
+        .warmup_settled = warmup_settled,
+    };
+}
+
+multi_queue_result base_coopmat_benchmark::run_multi_queue(
+        device_context& context,
+        std::uint32_t blocks_in_kernel,
+        std::size_t rounds)
+{
+    const auto& config = context.get_configuration();
+    const auto queue_count = context.get_queue_count();
+
+    // All queues run the same pipeline on the same buffers, the results are garbage anyway.
+    // create_buffers() made them concurrent if the queues are from more than one family
+    VkQueryPoolCreateInfo qpci
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = static_cast<std::uint32_t>(2*queue_count),
+    };
+    VkQueryPool query_pool;
+    if(VK_SUCCESS != vkCreateQueryPool(device, &qpci, nullptr, &query_pool))
+    {
+        throw std::runtime_error("Failed to create query pool");
+    }
+
+    std::vector<VkFence> fences(queue_count, VK_NULL_HANDLE);
+    auto destroy_objects = [&]()
+    {
+        for(auto fence : fences)
+        {
+            vkDestroyFence(device, fence, nullptr);
+        }
+        vkDestroyQueryPool(device, query_pool, nullptr);
+    };
+
+    std::vector<VkCommandBuffer> command_buffers(queue_count);
+    try
+    {
+        VkFenceCreateInfo fci
+        {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        for(auto& fence : fences)
+        {
+            if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+            {
+                throw std::runtime_error("Failed to create fence");
+            }
+        }
+
+        // Record everything first, so the submits go out as close together as possible.
+        // The same command buffers go out every round, the query reset is part of them
+        std::uint32_t gpu_n = static_cast<std::uint32_t>(inner_iterations);
+        VkCommandBufferBeginInfo cbbi
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        };
+        for(std::size_t q = 0; q < queue_count; q++)
+        {
+            const bool timestamps = context.get_timestamp_valid_bits(q) > 0;
+            auto command_buffer = command_buffers[q] = context.get_command_buffer(0, q);
+            vkBeginCommandBuffer(command_buffer, &cbbi);
+            if(timestamps)
+            {
+                vkCmdResetQueryPool(command_buffer, query_pool, 2*q, 2);
+            }
+            bind_kernel(command_buffer, config, gpu_n);
+            if(timestamps)
+            {
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 2*q+0);
+            }
+            for(std::size_t i = 0; i < outer_iterations; i++)
+            {
+                vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+            }
+            if(timestamps)
+            {
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 2*q+1);
+            }
+            vkEndCommandBuffer(command_buffer);
+        }
+
+        multi_queue_result mq_result
+        {
+            .ops = get_ops_per_dispatch(blocks_in_kernel),
+            .dispatches_per_queue = outer_iterations,
+        };
+        for(std::size_t q = 0; q < queue_count; q++)
+        {
+            mq_result.queues.push_back(queue_result
+            {
+                .family_index = context.get_queue_family_index(q),
+                .index_in_family = context.get_queue_index_in_family(q),
+                .nanoseconds = {},
+                .gops_per_sec = 0.0,
+            });
+        }
+
+        // Round 0 only warms up (clocks, caches, the first submit on a queue), it isn't recorded
+        for(std::size_t round = 0; round <= rounds; round++)
+        {
+            if(VK_SUCCESS != vkResetFences(device, fences.size(), fences.data()))
+            {
+                throw std::runtime_error("Failed to reset fences");
+            }
+            auto start = std::chrono::steady_clock::now();
+            for(std::size_t q = 0; q < queue_count; q++)
+            {
+                VkSubmitInfo si
+                {
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .commandBufferCount = 1,
+                    .pCommandBuffers = &command_buffers[q],
+                };
+                if(VK_SUCCESS != vkQueueSubmit(context.get_queue(q), 1, &si, fences[q]))
+                {
+                    throw std::runtime_error("Failed submitting command buffer to queue");
+                }
+            }
+            VkResult result = vkWaitForFences(device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+            while((result == VK_TIMEOUT) || (result == VK_NOT_READY))
+            {
+                fmt::print("Timed out, waiting again\n");
+                result = vkWaitForFences(device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+            }
+            if(VK_SUCCESS != result)
+            {
+                fmt::print("Error waiting for queues: {}\n", string_VkResult(result));
+                throw std::runtime_error("Failed waiting for queues");
+            }
+            auto end = std::chrono::steady_clock::now();
+            if(round == 0)
+            {
+                continue;
+            }
+
+            mq_result.wall_nanoseconds.push_back(std::chrono::duration<double, std::nano>(end - start).count());
+            for(std::size_t q = 0; q < queue_count; q++)
+            {
+                if(context.get_timestamp_valid_bits(q) > 0)
+                {
+                    std::array<std::uint64_t, 2> ticks;
+                    vkGetQueryPoolResults(device, query_pool, 2*q, 2, sizeof(ticks), ticks.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+                    mq_result.queues[q].nanoseconds.push_back(static_cast<double>(ticks[1] - ticks[0])*context.get_timestamp_period());
+                }
+            }
+        }
+
+        // The wall time includes the submits and the fence wait, so it's a lower bound of what the queues
+        // can do together. Every round is a sample, the medians are what gets compared to run()
+        const auto ops = static_cast<double>(mq_result.ops*outer_iterations);
+        const auto wall = compute_timing_statistics(mq_result.wall_nanoseconds, measurement.statistics);
+        mq_result.aggregate_gops_per_sec = ops*static_cast<double>(queue_count)/wall.median;
+
+        fmt::print("Multi-queue: {} queues, {} rounds\n", queue_count, rounds);
+        for(auto& qr : mq_result.queues)
+        {
+            if(!qr.nanoseconds.empty())
+            {
+                const auto median = compute_timing_statistics(qr.nanoseconds, measurement.statistics).median;
+                qr.gops_per_sec = ops/median;
+                fmt::print("    Queue {}.{}: {:.0f} ns median, {:.2f} GOP/s\n",
+                        qr.family_index, qr.index_in_family, median, qr.gops_per_sec);
+            }
+            else
+            {
+                fmt::print("    Queue {}.{}: no timestamp support\n", qr.family_index, qr.index_in_family);
+            }
+        }
+        fmt::print("    Aggregate: {:.0f} ns median wall time (CI {:.0f}-{:.0f}), {:.2f} GOP/s\n",
+                wall.median, wall.ci_low, wall.ci_high, mq_result.aggregate_gops_per_sec);
+
+        destroy_objects();
+        return mq_result;
+    }
+    catch(...)
+    {
+        // Don't destroy anything that might still be in flight
+        vkDeviceWaitIdle(device);
+        destroy_objects();
+        throw;
+    }
+}
+
+std::vector<latency_result> base_coopmat_benchmark::run_latency(
+        device_context& context,
+        std::size_t samples)
+{
+    const auto& config = context.get_configuration();
+    auto queue = context.get_queue();
+    const auto timestamp_period = context.get_timestamp_period();
+    // Only the loads and stores around the mma loop are left, so what we see is
+    // (mostly) the cost of getting a dispatch through the GPU
+    constexpr std::uint32_t gpu_n = 0;
+    // submit_per_dispatch needs one command buffer per dispatch in flight, it goes in rounds of these
+    constexpr std::size_t command_buffers_per_round = 64;
+    samples = std::max<std::size_t>(samples, 2);
+
+    VkQueryPoolCreateInfo qpci
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = static_cast<std::uint32_t>(samples + 1),
+    };
+    VkQueryPool query_pool = VK_NULL_HANDLE;
+    VkFence fence = VK_NULL_HANDLE;
+    auto destroy_objects = [&]()
+    {
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyQueryPool(device, query_pool, nullptr);
+    };
+    if(VK_SUCCESS != vkCreateQueryPool(device, &qpci, nullptr, &query_pool))
+    {
+        throw std::runtime_error("Failed to create query pool");
+    }
+    VkFenceCreateInfo fci
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+    {
+        destroy_objects();
+        throw std::runtime_error("Failed to create fence");
+    }
+
+    VkCommandBufferBeginInfo cbbi
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    };
+    auto submit = [&](const VkCommandBuffer* command_buffers, std::size_t count, VkFence signal)
+    {
+        VkSubmitInfo si
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = static_cast<std::uint32_t>(count),
+            .pCommandBuffers = command_buffers,
+        };
+        if(VK_SUCCESS != vkQueueSubmit(queue, 1, &si, signal))
+        {
+            throw std::runtime_error("Failed submitting command buffer to queue");
+        }
+    };
+    // Durations between successive timestamps first..last
+    auto timestamp_deltas = [&](std::size_t first, std::size_t last, std::vector<double>& durations)
+    {
+        std::vector<std::uint64_t> ticks(last - first + 1);
+        vkGetQueryPoolResults(device, query_pool, first, ticks.size(), ticks.size()*sizeof(std::uint64_t), ticks.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+        for(std::size_t i = 1; i < ticks.size(); i++)
+        {
+            durations.push_back(static_cast<double>(ticks[i] - ticks[i-1])*timestamp_period);
+        }
+    };
+
+    // One command buffer with 'samples' dispatches, the time between the end of
+    // one dispatch and the next is what a dispatch costs in a stream of them
+    auto in_one_command_buffer = [&](bool barriers) -> std::vector<double>
+    {
+        VkMemoryBarrier mb
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        };
+        auto command_buffer = context.get_command_buffer();
+        vkBeginCommandBuffer(command_buffer, &cbbi);
+        vkCmdResetQueryPool(command_buffer, query_pool, 0, samples + 1);
+        bind_kernel(command_buffer, config, gpu_n);
+        vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 0);
+        for(std::size_t i = 0; i < samples; i++)
+        {
+            if(barriers && i > 0)
+            {
+                vkCmdPipelineBarrier(command_buffer,
+                        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        0, 1, &mb, 0, nullptr, 0, nullptr);
+            }
+            vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i+1);
+        }
+        vkEndCommandBuffer(command_buffer);
+        submit(&command_buffer, 1, fence);
+        wait_fence(device, fence);
+
+        std::vector<double> durations;
+        timestamp_deltas(0, samples, durations);
+        return durations;
+    };
+
+    // Every dispatch in its own command buffer and vkQueueSubmit. The first one of a round
+    // has no submit boundary in front of it, so it only provides the starting timestamp
+    auto submit_per_dispatch = [&]() -> std::vector<double>
+    {
+        std::vector<double> durations;
+        std::vector<VkCommandBuffer> command_buffers;
+        while(durations.size() < samples)
+        {
+            auto count = std::min(command_buffers_per_round, samples - durations.size() + 1);
+            command_buffers.resize(count);
+            for(std::size_t i = 0; i < count; i++)
+            {
+                auto command_buffer = command_buffers[i] = context.get_command_buffer(i);
+                vkBeginCommandBuffer(command_buffer, &cbbi);
+                if(i == 0)
+                {
+                    vkCmdResetQueryPool(command_buffer, query_pool, 0, count);
+                }
+                bind_kernel(command_buffer, config, gpu_n);
+                vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+                vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i);
+                vkEndCommandBuffer(command_buffer);
+            }
+            for(std::size_t i = 0; i < count; i++)
+            {
+                submit(&command_buffers[i], 1, (i + 1 == count) ? fence : VK_NULL_HANDLE);
+            }
+            wait_fence(device, fence);
+            timestamp_deltas(0, count - 1, durations);
+        }
+        return durations;
+    };
+
+    // What the host sees for a single dispatch, the command buffer is recorded once
+    auto submit_to_fence = [&]() -> std::vector<double>
+    {
+        auto command_buffer = context.get_command_buffer();
+        vkBeginCommandBuffer(command_buffer, &cbbi);
+        bind_kernel(command_buffer, config, gpu_n);
+        vkCmdDispatch(command_buffer, get_dispatch_groups(), 1, 1);
+        vkEndCommandBuffer(command_buffer);
+
+        std::vector<double> durations(samples);
+        for(auto& duration : durations)
+        {
+            auto start = std::chrono::steady_clock::now();
+            submit(&command_buffer, 1, fence);
+            wait_fence(device, fence);
+            auto end = std::chrono::steady_clock::now();
+            duration = std::chrono::duration<double, std::nano>(end - start).count();
+        }
+        return durations;
+    };
+
+    std::vector<latency_result> results;
+    try
+    {
+        // Untimed, so clocks are up and the first-use costs are paid before anything counts
+        in_one_command_buffer(false);
+
+        for(auto mode : {latency_mode::back_to_back, latency_mode::barrier_between,
+                         latency_mode::submit_per_dispatch, latency_mode::submit_to_fence})
+        {
+            latency_result result{ .mode = mode };
+            switch(mode)
+            {
+                case latency_mode::back_to_back: result.nanoseconds = in_one_command_buffer(false); break;
+                case latency_mode::barrier_between: result.nanoseconds = in_one_command_buffer(true); break;
+                case latency_mode::submit_per_dispatch: result.nanoseconds = submit_per_dispatch(); break;
+                case latency_mode::submit_to_fence: result.nanoseconds = submit_to_fence(); break;
+            }
+            result.statistics = compute_timing_statistics(result.nanoseconds, measurement.statistics);
+            result.histogram = compute_latency_histogram(result.nanoseconds);
+
+            const auto& stats = result.statistics;
+            fmt::print("Latency {}: Med. {:.0f} ns, Min. {:.0f} ns, p95 {:.0f} ns, p99 {:.0f} ns, {} samples\n",
+                    latency_mode_to_str(mode), stats.median, stats.raw_min, stats.p95, stats.p99, result.nanoseconds.size());
+            print_latency_histogram(result.histogram);
+            results.push_back(std::move(result));
+        }
+    }
+    catch(...)
+    {
+        // Don't destroy anything that might still be in flight
+        vkDeviceWaitIdle(device);
+        destroy_objects();
+        throw;
+    }
+
+    destroy_objects();
+    return results;
+}
+
+std::uint64_t base_coopmat_benchmark::get_ops_per_dispatch(std::uint32_t blocks_in_kernel) const
+{
+    if(phase != kernel_phase::full)
+    {
+        return 0;
+    }
+    return std::uint64_t{num_groups}*inner_iterations*(cmprops.MSize*cmprops.NSize*cmprops.KSize*2)*insts_in_block*blocks_in_kernel;
 }
 
 void base_coopmat_benchmark::cleanup()
@@ -387,23 +1128,157 @@ TYPE_MAP_MP(FLOAT, float)
 #undef TYPE_MAP
 
 
-#define CCB(a,b,c)\
-if(cmprops.AType == EV(VK_COMPONENT_TYPE_, a, _KHR) &&\
-   cmprops.BType == EV(VK_COMPONENT_TYPE_, b, _KHR) &&\
-   cmprops.CType == EV(VK_COMPONENT_TYPE_, c, _KHR) &&\
-   cmprops.CType == cmprops.ResultType)\
-{\
-    using a_type = typename comp_type_map<EV(VK_COMPONENT_TYPE_, a, _KHR)>::type;\
-    using b_type = typename comp_type_map<EV(VK_COMPONENT_TYPE_, b, _KHR)>::type;\
-    using c_type = typename comp_type_map<EV(VK_COMPONENT_TYPE_, c, _KHR)>::type;\
-    return std::make_unique<coopmat_benchmark<\
-        a_type,\
-        b_type,\
-        c_type>>(\
-        phy_device, device, cmprops,\
-        insts_in_block, inner_iterations, outer_iterations, num_groups);\
+namespace
+{
+    // VK_COMPONENT_TYPE_FLOAT16_KHR (0) up to VK_COMPONENT_TYPE_UINT64_KHR (10),
+    // everything comp_type_map has a host type for. BFloat16 and the FP8 types (1000141000 and up)
+    // would need their GLSL extensions and device features enabled, entries with them are skipped
+    constexpr std::size_t component_type_count = 11;
+
+    template<std::size_t index>
+    using host_type = typename comp_type_map<static_cast<VkComponentTypeKHR>(index)>::type;
+
+    template<typename T>
+    using widen_function = void (*)(const std::byte*, std::size_t, T*);
+    using fill_function = void (*)(std::byte*, std::size_t, std::uint64_t, bool);
+
+    template<std::size_t index, typename T>
+    void widen(const std::byte* data, std::size_t count, T* out)
+    {
+        const auto* in = reinterpret_cast<const host_type<index>*>(data);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            out[i] = static_cast<T>(in[i]);
+        }
+    }
+
+    template<std::size_t index>
+    void fill(std::byte* data, std::size_t count, std::uint64_t seed, bool accumulator)
+    {
+        fill_reference_input(std::span(reinterpret_cast<host_type<index>*>(data), count), seed, accumulator);
+    }
+
+    template<typename T, std::size_t... indices>
+    constexpr auto make_widen_table(std::index_sequence<indices...>)
+    {
+        return std::array<widen_function<T>, sizeof...(indices)>{&widen<indices, T>...};
+    }
+
+    template<std::size_t... indices>
+    constexpr auto make_fill_table(std::index_sequence<indices...>)
+    {
+        return std::array<fill_function, sizeof...(indices)>{&fill<indices>...};
+    }
+
+    constexpr auto fill_table = make_fill_table(std::make_index_sequence<component_type_count>{});
+
+    std::size_t component_index(VkComponentTypeKHR type)
+    {
+        auto index = static_cast<std::size_t>(type);
+        if(index >= component_type_count)
+        {
+            throw std::runtime_error(fmt::format("unsupported VkComponentTypeKHR {}", index));
+        }
+        return index;
+    }
+
+    using benchmark_factory = std::unique_ptr<base_coopmat_benchmark> (*)(
+            VkPhysicalDevice,
+            VkDevice,
+            VkCooperativeMatrixPropertiesKHR,
+            std::size_t,
+            std::size_t,
+            std::size_t,
+            std::size_t);
+
+    template<std::size_t d_index>
+    std::unique_ptr<base_coopmat_benchmark> make_coop_benchmark(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            std::size_t insts_in_block,
+            std::size_t inner_iterations,
+            std::size_t outer_iterations,
+            std::size_t num_groups)
+    {
+        return std::make_unique<coopmat_benchmark<host_type<d_index>>>(
+                phy_device, device, cmprops,
+                insts_in_block, inner_iterations, outer_iterations, num_groups);
+    }
+
+    template<std::size_t... indices>
+    constexpr auto make_result_factories(std::index_sequence<indices...>)
+    {
+        return std::array<benchmark_factory, sizeof...(indices)>{&make_coop_benchmark<indices>...};
+    }
+
+    // FLOAT16, FLOAT32 and FLOAT64 come first
+    constexpr bool is_float_index(std::size_t index)
+    {
+        return index <= static_cast<std::size_t>(VK_COMPONENT_TYPE_FLOAT64_KHR);
+    }
+
+    constexpr std::size_t combination_index(std::size_t a, std::size_t b, std::size_t c, std::size_t d)
+    {
+        return ((a*component_type_count + b)*component_type_count + c)*component_type_count + d;
+    }
+
+    // Every (A, B, C, result) combination. Entries with the same result type share their factory,
+    // the ones that can't work are nullptr: A and B have to be both integers or both floats
+    // (coopMatMulAdd doesn't mix them), float products don't go into integer accumulators,
+    // and C has to be the result type (GLSL's coopMatMulAdd returns the type of its C operand)
+    constexpr auto factory_table = []
+    {
+        constexpr auto result_factories = make_result_factories(std::make_index_sequence<component_type_count>{});
+        std::array<benchmark_factory, combination_index(component_type_count, 0, 0, 0)> table{};
+        for(std::size_t a = 0; a < component_type_count; a++)
+        for(std::size_t b = 0; b < component_type_count; b++)
+        for(std::size_t c = 0; c < component_type_count; c++)
+        for(std::size_t d = 0; d < component_type_count; d++)
+        {
+            const bool float_inputs = is_float_index(a);
+            const bool supported =
+                (is_float_index(b) == float_inputs) &&
+                !(float_inputs && (!is_float_index(c) || !is_float_index(d))) &&
+                (c == d);
+            table[combination_index(a, b, c, d)] = supported ? result_factories[d] : nullptr;
+        }
+        return table;
+    }();
+
+    benchmark_factory find_factory(const VkCooperativeMatrixPropertiesKHR& cmprops)
+    {
+        auto index = [](VkComponentTypeKHR type)
+        {
+            return static_cast<std::size_t>(type);
+        };
+        if(index(cmprops.AType) >= component_type_count || index(cmprops.BType) >= component_type_count ||
+           index(cmprops.CType) >= component_type_count || index(cmprops.ResultType) >= component_type_count)
+        {
+            return nullptr;
+        }
+        return factory_table[combination_index(
+                index(cmprops.AType), index(cmprops.BType), index(cmprops.CType), index(cmprops.ResultType))];
+    }
+}
+
+void fill_component_buffer(VkComponentTypeKHR type, std::byte* data, std::size_t count, std::uint64_t seed, bool accumulator)
+{
+    fill_table[component_index(type)](data, count, seed, accumulator);
+}
+
+template<typename T>
+std::vector<T> widen_component_buffer(VkComponentTypeKHR type, const std::byte* data, std::size_t count)
+{
+    static constexpr auto widen_table = make_widen_table<T>(std::make_index_sequence<component_type_count>{});
+    std::vector<T> values(count);
+    widen_table[component_index(type)](data, count, values.data());
+    return values;
 }
 
+template std::vector<std::int64_t> widen_component_buffer(VkComponentTypeKHR, const std::byte*, std::size_t);
+template std::vector<double> widen_component_buffer(VkComponentTypeKHR, const std::byte*, std::size_t);
+
 std::unique_ptr<base_coopmat_benchmark> create_coop_benchmark(
         VkPhysicalDevice phy_device,
         VkDevice device,
@@ -413,22 +1288,20 @@ std::unique_ptr<base_coopmat_benchmark> create_coop_benchmark(
         std::size_t outer_iterations,
         std::size_t num_groups)
 {
-    CCB(SINT8, SINT8, SINT32)
-    CCB(UINT8, UINT8, UINT32)
-    CCB(SINT8, SINT8, UINT32)
-    CCB(UINT8, UINT8, SINT32)
-    CCB(UINT8, SINT8, SINT32)
-    CCB(SINT8, UINT8, SINT32)
-    CCB(UINT8, SINT8, UINT32)
-    CCB(SINT8, UINT8, UINT32)
-    CCB(FLOAT16, FLOAT16, FLOAT16)
-    CCB(FLOAT16, FLOAT16, FLOAT32)
-    CCB(FLOAT32, FLOAT32, FLOAT32)
-    CCB(FLOAT64, FLOAT64, FLOAT64)
-
-    throw std::runtime_error("unsupported VkComponentTypeKHR");
+    auto factory = find_factory(cmprops);
+    if(!factory)
+    {
+        throw std::runtime_error(fmt::format("unsupported VkComponentTypeKHR combination {}/{}/{}/{}",
+                    component_type_to_str(cmprops.AType), component_type_to_str(cmprops.BType),
+                    component_type_to_str(cmprops.CType), component_type_to_str(cmprops.ResultType)));
+    }
+    return factory(phy_device, device, cmprops, insts_in_block, inner_iterations, outer_iterations, num_groups);
+}
+
+bool coop_benchmark_supports(const VkCooperativeMatrixPropertiesKHR& cmprops)
+{
+    return find_factory(cmprops) != nullptr;
 }
 
-#undef CCB
 #undef EV
 #undef PASTER
@@ -1,7 +1,15 @@
+#ifndef COOPMAT_BENCHMARK
+#define COOPMAT_BENCHMARK
+
 #include <algorithm>
+#include <compare>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
 #include <map>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <stdfloat>
 #include <string>
 #include <string_view>
@@ -10,12 +18,168 @@
 #include <fmt/format.h>
 #include <vulkan/vulkan.h>
 
-#include "vk_find_memory_type.hpp"
 #include "vk_component_type_to_str.hpp"
 #include "coopmat_benchmark_shader.hpp"
+#include "device_context.hpp"
+#include "memory_arena.hpp"
+#include "reference_gemm.hpp"
+#include "timing_statistics.hpp"
 
 template<VkComponentTypeKHR vk_type> struct comp_type_map;
 
+struct tuning_parameters
+{
+    std::uint32_t blocks_in_kernel;
+    std::uint32_t insts_in_block;
+    std::uint32_t num_groups;
+
+    auto operator<=>(const tuning_parameters&) const = default;
+};
+
+// These numbers go to ~ 95% FLOPS on GH200 (of what you can do with Vulkan - which is somewhat 
+// en par with MMA/WMMA CUDA, but falls short of what you can get with WGMMA).
+// You can get a bit more by making them bigger and can make them somewhat smaller and still get > 90%
+
+// These are only the defaults now, run with --autotune to find better ones
+// for your GPU, they will be picked up from the tuning file afterwards
+inline constexpr tuning_parameters default_tuning
+{
+    .blocks_in_kernel = 4,
+    .insts_in_block = 8,
+    // Not sure what to base this number on, I guess it should be something like
+    // number_of_compute_units*warps_per_sm, but vulkan doesn't expose functionality
+    // to get those numbers. --scaling measures where a device actually saturates
+    .num_groups = 132*8,
+};
+
+struct benchmark_result
+{
+    double min_nanoseconds;
+    double avg_nanoseconds;
+    double max_gops_per_sec;
+    double avg_gops_per_sec;
+    double pipeline_creation_nanoseconds;
+    bool pipeline_cache_hit;
+    // Raw query results, begin/end tick pair per dispatch
+    std::vector<std::uint64_t> timestamps;
+    float timestamp_period;
+    // Operations and bytes moved per dispatch, depending on what the kernel measures
+    std::uint64_t ops;
+    std::uint64_t bytes;
+    timing_statistics statistics;
+    // Untimed dispatches before the measurement, and whether the timings settled in that time
+    std::uint32_t warmup_iterations;
+    bool warmup_settled;
+};
+
+struct queue_result
+{
+    std::uint32_t family_index;
+    std::uint32_t index_in_family;
+    // One per round, from the first to the last timestamp on this queue, empty if the family has no timestamps
+    std::vector<double> nanoseconds;
+    // Of the median round
+    double gops_per_sec;
+};
+
+struct multi_queue_result
+{
+    std::vector<queue_result> queues;
+    // One per round, host side, from the first submit until all queues are done
+    std::vector<double> wall_nanoseconds;
+    // Of the median round
+    double aggregate_gops_per_sec;
+    // Per dispatch, every queue got dispatches_per_queue of them in every round
+    std::uint64_t ops;
+    std::size_t dispatches_per_queue;
+};
+
+// Cut-down versions of the mma kernel for the phase breakdown, every one does a bit more
+// of the full kernel than the one before: nothing, load A/B/C, load and store C, everything.
+// load and load_store write the loaded tiles to scratch, or the loads could be dropped
+enum class kernel_phase
+{
+    empty,
+    load,
+    load_store,
+    full,
+};
+
+inline auto kernel_phase_to_str(kernel_phase phase) -> std::string_view
+{
+    switch(phase)
+    {
+        case kernel_phase::empty: return "empty";
+        case kernel_phase::load: return "load";
+        case kernel_phase::load_store: return "load-store";
+        case kernel_phase::full: return "full";
+    }
+    return "unknown";
+}
+
+// What coopmat.comp.glsl.in needs defined to build 'phase', nothing for the full kernel
+inline void add_kernel_phase_macros(coopmat_benchmark_shader::macro_list& macros, kernel_phase phase)
+{
+    switch(phase)
+    {
+        case kernel_phase::empty: macros.emplace_back("PHASE_EMPTY", "1"); break;
+        case kernel_phase::load: macros.emplace_back("PHASE_LOAD", "1"); break;
+        case kernel_phase::load_store: macros.emplace_back("PHASE_LOAD_STORE", "1"); break;
+        case kernel_phase::full: break;
+    }
+}
+
+// What run_latency() measures, all with params.n = 0
+enum class latency_mode
+{
+    // Dispatches recorded back to back in one command buffer
+    back_to_back,
+    // Same, with a compute->compute barrier between them, so every dispatch drains the GPU
+    barrier_between,
+    // One vkQueueSubmit per dispatch
+    submit_per_dispatch,
+    // Host wall clock from vkQueueSubmit until vkWaitForFences returns, one dispatch each
+    submit_to_fence,
+};
+
+inline auto latency_mode_to_str(latency_mode mode) -> std::string_view
+{
+    switch(mode)
+    {
+        case latency_mode::back_to_back: return "back-to-back";
+        case latency_mode::barrier_between: return "barrier-between";
+        case latency_mode::submit_per_dispatch: return "submit-per-dispatch";
+        case latency_mode::submit_to_fence: return "submit-to-fence";
+    }
+    return "unknown";
+}
+
+struct latency_result
+{
+    latency_mode mode;
+    // Per dispatch, GPU timestamps for everything but submit_to_fence
+    std::vector<double> nanoseconds;
+    timing_statistics statistics;
+    latency_histogram histogram;
+};
+
+// How long run() keeps measuring
+struct measurement_settings
+{
+    // Keep adding batches of outer_iterations dispatches until the CI of the median
+    // is within +- this fraction of it, 0 means a single batch
+    double ci_tolerance = 0.0;
+    // Per benchmark, whichever limit is hit first ends the measurement
+    double time_budget_seconds = 10.0;
+    std::uint32_t max_repetitions = 10000;
+    statistics_settings statistics;
+    // Warm-up runs batches of warmup_batch dispatches until two successive batch
+    // medians are within warmup_threshold of each other, 0 max_warmup_iterations disables it
+    std::uint32_t max_warmup_iterations = 128;
+    std::uint32_t warmup_batch = 8;
+    double warmup_threshold = 0.02;
+};
+
 class base_coopmat_benchmark
 {
 public:
@@ -43,9 +207,30 @@ public:
         this->shader = shader;
     }
 
+    auto get_shader() -> std::shared_ptr<coopmat_benchmark_shader>
+    {
+        return shader;
+    }
+
+    void set_measurement_settings(const measurement_settings& measurement)
+    {
+        this->measurement = measurement;
+    }
+
+    // Has to match the shader, the cut-down kernels don't count any ops and can't be validated
+    void set_phase(kernel_phase phase)
+    {
+        this->phase = phase;
+    }
+
+    auto get_phase() const -> kernel_phase
+    {
+        return phase;
+    }
+
     void create_descriptors();
 
-    virtual void create_buffers() = 0;
+    virtual void create_buffers(const device_context& context) = 0;
     void destroy_buffers();
 
     auto get_cmprops() -> auto
@@ -58,10 +243,82 @@ public:
         return device;
     }
 
-    void run(coopmat_benchmark_shader::configuration config,
-            VkQueue queue, VkCommandBuffer command_buffer,
-	    std::uint32_t blocks_in_kernel);
+    auto get_phy_device() -> VkPhysicalDevice
+    {
+        return phy_device;
+    }
+
+    auto get_num_groups() const -> std::size_t
+    {
+        return num_groups;
+    }
+
+    // What the load and load-store kernels copy to scratch per dispatch (A, B and all C tiles),
+    // and what the C store of the load-store and full kernels writes
+    auto get_scratch_store_bytes() const -> std::size_t
+    {
+        return num_groups*(component_type_size(cmprops.AType)*cmprops.MSize*cmprops.KSize +
+                           component_type_size(cmprops.BType)*cmprops.KSize*cmprops.NSize +
+                           component_type_size(cmprops.CType)*cmprops.MSize*cmprops.NSize*insts_in_block);
+    }
+
+    auto get_c_store_bytes() const -> std::size_t
+    {
+        return num_groups*component_type_size(cmprops.ResultType)*cmprops.MSize*cmprops.NSize*insts_in_block;
+    }
+
+    // Subgroups per workgroup, has to match the shader (WG_SUBGROUPS). num_groups stays the number
+    // of tile sets, so with subgroup scope it has to be a multiple of this and the dispatch gets
+    // fewer, bigger workgroups. With workgroup scope a whole workgroup works on one tile set
+    void set_workgroup_subgroups(std::uint32_t workgroup_subgroups)
+    {
+        if(workgroup_subgroups == 0 ||
+           (cmprops.scope == VK_SCOPE_SUBGROUP_KHR && num_groups % workgroup_subgroups != 0))
+        {
+            throw std::runtime_error(fmt::format("{} groups can't be split into workgroups of {} subgroups",
+                        num_groups, workgroup_subgroups));
+        }
+        this->workgroup_subgroups = workgroup_subgroups;
+    }
+
+    auto get_workgroup_subgroups() const -> std::uint32_t
+    {
+        return workgroup_subgroups;
+    }
+
+    // What goes into vkCmdDispatch
+    auto get_dispatch_groups() const -> std::uint32_t
+    {
+        if(cmprops.scope == VK_SCOPE_WORKGROUP_KHR)
+        {
+            return static_cast<std::uint32_t>(num_groups);
+        }
+        return static_cast<std::uint32_t>(num_groups/workgroup_subgroups);
+    }
+
+    benchmark_result run(device_context& context, std::uint32_t blocks_in_kernel);
+    // Submits outer_iterations dispatches to every queue of the context at once, an untimed
+    // round and then 'rounds' timed ones. Expects the pipeline to exist already (i.e. run() was called before)
+    multi_queue_result run_multi_queue(device_context& context, std::uint32_t blocks_in_kernel, std::size_t rounds);
+    // Launch overhead of the kernel: every latency_mode with 'samples' dispatches each,
+    // expects the pipeline to exist already (i.e. run() was called before)
+    std::vector<latency_result> run_latency(device_context& context, std::size_t samples);
     void cleanup();
+
+    // Fills A/B/C with seeded data, runs a single dispatch with params.n = 1 and compares
+    // C against a host reference. Expects the pipeline to exist already (i.e. run() was called before).
+    // Kernels without a host reference return nothing
+    virtual std::optional<validation_result> validate(device_context&, std::uint32_t, std::uint64_t)
+    {
+        return std::nullopt;
+    }
+
+    // What one dispatch does, for the throughput numbers
+    virtual std::uint64_t get_ops_per_dispatch(std::uint32_t blocks_in_kernel) const;
+    virtual std::uint64_t get_bytes_per_dispatch(std::uint32_t) const
+    {
+        return 0;
+    }
 protected:
     VkPhysicalDevice phy_device;
     VkDevice device;
@@ -73,25 +330,57 @@ protected:
     std::size_t inner_iterations;
     std::size_t outer_iterations;
     std::size_t num_groups;
+    std::uint32_t workgroup_subgroups = 1;
+
+    measurement_settings measurement;
+    kernel_phase phase = kernel_phase::full;
 
-    VkBuffer a_buffer;
-    VkBuffer b_buffer;
-    VkBuffer c_buffer;
-    VkBuffer a_host_buffer;
-    VkBuffer b_host_buffer;
-    VkBuffer c_host_buffer;
+    VkBuffer a_buffer = VK_NULL_HANDLE;
+    VkBuffer b_buffer = VK_NULL_HANDLE;
+    VkBuffer c_buffer = VK_NULL_HANDLE;
+    VkBuffer a_host_buffer = VK_NULL_HANDLE;
+    VkBuffer b_host_buffer = VK_NULL_HANDLE;
+    VkBuffer c_host_buffer = VK_NULL_HANDLE;
 
-    VkBuffer devptr_buffer;
+    // Only with address_binding::descriptor, the push constant path hands the addresses over directly
+    VkBuffer devptr_buffer = VK_NULL_HANDLE;
+    VkDeviceAddress a_address = 0;
+    VkDeviceAddress b_address = 0;
+    VkDeviceAddress c_address = 0;
 
     VkMemoryRequirements2 a_mem_reqs{}, b_mem_reqs{}, c_mem_reqs{}, devptr_mem_reqs{};
-    VkDeviceMemory dev_memory;
-    VkDeviceMemory host_memory;
-    VkDeviceMemory devptr_memory;
+    // Sub-allocated from the device's arena, the host ones are mapped
+    memory_arena* arena = nullptr;
+    memory_arena::allocation a_memory, b_memory, c_memory;
+    memory_arena::allocation a_host_memory, b_host_memory, c_host_memory;
+    memory_arena::allocation devptr_memory;
 
-    void create_buffers(std::size_t a_type_size, std::size_t b_type_size, std::size_t c_type_size);
+    // What was asked for in create_buffers, the allocations may be larger
+    std::size_t a_size, b_size, c_size;
+
+    void create_buffers(const device_context& context, std::size_t a_bytes, std::size_t b_bytes, std::size_t c_bytes);
+    void update_descriptors(const coopmat_benchmark_shader::configuration& config);
+    // Push constants (params.n, plus the addresses if the configuration wants them),
+    // descriptor set if there is one, and the pipeline
+    void bind_kernel(VkCommandBuffer command_buffer, const coopmat_benchmark_shader::configuration& config, std::uint32_t n);
+
+    // Host -> device copies of A/B/C, one dispatch with params.n = 1, and C back to the host buffer
+    void run_validation_dispatch(device_context& context);
 };
 
-template<typename a_type, typename b_type, typename c_type>
+// Host side of A/B/C, for every type comp_type_map knows. Only the result type is a template
+// parameter of coopmat_benchmark, the inputs are filled and read back through these.
+// Like fill_reference_input, for 'count' elements of 'type' at 'data'
+void fill_component_buffer(VkComponentTypeKHR type, std::byte* data, std::size_t count, std::uint64_t seed, bool accumulator);
+// 'count' elements of 'type' at 'data' converted to T (reference_accumulator_t, so std::int64_t or double)
+template<typename T>
+std::vector<T> widen_component_buffer(VkComponentTypeKHR type, const std::byte* data, std::size_t count);
+extern template std::vector<std::int64_t> widen_component_buffer(VkComponentTypeKHR, const std::byte*, std::size_t);
+extern template std::vector<double> widen_component_buffer(VkComponentTypeKHR, const std::byte*, std::size_t);
+
+// d_type is what the kernel accumulates in and stores (ResultType, always the same as CType),
+// the result is written over C
+template<typename d_type>
 class coopmat_benchmark : public base_coopmat_benchmark
 {
 public:
@@ -111,28 +400,62 @@ public:
                 insts_in_block,
                 inner_iterations,
                 outer_iterations,
-                num_groups),
-        a_mapped_ptr(nullptr),
-        b_mapped_ptr(nullptr),
-        c_mapped_ptr(nullptr)
+                num_groups)
     {}
     virtual ~coopmat_benchmark() = default;
 
 
-    virtual void create_buffers()
+    virtual void create_buffers(const device_context& context)
     {
-        base_coopmat_benchmark::create_buffers(sizeof(a_type), sizeof(b_type), sizeof(c_type));
+        // The load and load-store kernels copy every tile they load to the second half
+        const std::size_t copies = (phase == kernel_phase::load || phase == kernel_phase::load_store) ? 2 : 1;
+        base_coopmat_benchmark::create_buffers(context,
+                copies*num_groups*component_type_size(cmprops.AType)*cmprops.MSize*cmprops.KSize,
+                copies*num_groups*component_type_size(cmprops.BType)*cmprops.KSize*cmprops.NSize,
+                copies*num_groups*std::max(component_type_size(cmprops.CType), sizeof(d_type))*cmprops.MSize*cmprops.NSize*insts_in_block);
     }
 
+    virtual std::optional<validation_result> validate(device_context& context, std::uint32_t blocks_in_kernel, std::uint64_t seed)
+    {
+        if(phase != kernel_phase::full)
+        {
+            return std::nullopt;
+        }
+        using acc_t = reference_accumulator_t<d_type>;
+
+        const std::size_t a_count = num_groups*cmprops.MSize*cmprops.KSize;
+        const std::size_t b_count = num_groups*cmprops.KSize*cmprops.NSize;
+        const std::size_t c_count = num_groups*cmprops.MSize*cmprops.NSize*insts_in_block;
+
+        // The host buffers are persistently mapped by the arena
+        fill_component_buffer(cmprops.AType, a_host_memory.mapped, a_count, seed, false);
+        fill_component_buffer(cmprops.BType, b_host_memory.mapped, b_count, seed+1, false);
+        fill_component_buffer(cmprops.CType, c_host_memory.mapped, c_count, seed+2, true);
+        auto a = widen_component_buffer<acc_t>(cmprops.AType, a_host_memory.mapped, a_count);
+        auto b = widen_component_buffer<acc_t>(cmprops.BType, b_host_memory.mapped, b_count);
+        auto c_initial = widen_component_buffer<acc_t>(cmprops.CType, c_host_memory.mapped, c_count);
 
-private:
+        run_validation_dispatch(context);
 
-    a_type* a_mapped_ptr;
-    b_type* b_mapped_ptr;
-    c_type* c_mapped_ptr;
+        return check_reference_gemm<d_type>(
+                reference_layout
+                {
+                    .m = cmprops.MSize,
+                    .n = cmprops.NSize,
+                    .k = cmprops.KSize,
+                    .num_groups = num_groups,
+                    .insts_in_block = insts_in_block,
+                    .repeats = blocks_in_kernel,
+                    .saturating = static_cast<bool>(cmprops.saturatingAccumulation),
+                },
+                a, b, c_initial, reinterpret_cast<const d_type*>(c_host_memory.mapped));
+    }
 };
 
 
+// O(1) lookup in a table over every (AType, BType, CType, ResultType), throws for combinations
+// it can't do (types without a host type, float inputs into integer accumulators, and CType != ResultType,
+// which GLSL's coopMatMulAdd can't express; main() runs those entries as their (A, B, R, R) entry or skips them)
 std::unique_ptr<base_coopmat_benchmark> create_coop_benchmark(
         VkPhysicalDevice phy_device,
         VkDevice device,
@@ -141,3 +464,7 @@ std::unique_ptr<base_coopmat_benchmark> create_coop_benchmark(
         std::size_t inner_iterations,
         std::size_t outer_iterations,
         std::size_t num_groups);
+// Whether create_coop_benchmark can do anything with these types
+bool coop_benchmark_supports(const VkCooperativeMatrixPropertiesKHR& cmprops);
+
+#endif /* ifndef COOPMAT_BENCHMARK */
@@ -1,42 +1,169 @@
 #include "coopmat_benchmark_shader.hpp"
+#include "precompiled_spirv.hpp"
+#include "shaderc_loader.hpp"
+#include "spirv_cache.hpp"
 #include "vk_component_type_to_str.hpp"
 
 #include <fmt/format.h>
-#include <shaderc/shaderc.h>
 #include <vulkan/vk_enum_string_helper.h>
 
 #include <algorithm>
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <map>
 #include <numeric>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    constexpr auto target_env = shaderc_target_env_vulkan;
+    constexpr auto target_env_version = shaderc_env_version_vulkan_1_3;
+    constexpr auto optimization_level = shaderc_optimization_level_performance;
+
+    std::vector<std::uint32_t> compile_spirv(
+            std::string_view code,
+            const std::vector<std::pair<std::string, std::string>>& macros,
+            lazy_shaderc_compiler* shared_compiler)
+    {
+        // Loads libshaderc if nothing did before, throws if it isn't there
+        const auto& shaderc = get_shaderc();
+        lazy_shaderc_compiler own_compiler;
+        auto compiler = shared_compiler ? shared_compiler->get() : own_compiler.get();
+        auto options = shaderc.compile_options_initialize();
+
+        for(const auto& kv : macros)
+        {
+            const auto& key = std::get<0>(kv);
+            const auto& value = std::get<1>(kv);
+            shaderc.compile_options_add_macro_definition(
+                    options,
+                    key.data(), key.size(),
+                    value.data(), value.size());
+        }
+
+        shaderc.compile_options_set_optimization_level(options, optimization_level);
+        shaderc.compile_options_set_target_env(options, target_env, target_env_version);
+
+        auto result = shaderc.compile_into_spv(
+                compiler, 
+                code.data(), code.size(), 
+                shaderc_compute_shader, "coopmat.comp.glsl", "main",
+                options);
+
+        if (shaderc.result_get_compilation_status(result) != shaderc_compilation_status_success)
+        {
+            fmt::print("GLSL->SPIR-V compilation failed with: {}\n", shaderc.result_get_error_message(result));
+            shaderc.result_release(result);
+            shaderc.compile_options_release(options);
+            throw std::runtime_error("GLSL to SPIR-V compilation failed");
+        }
+
+        const std::uint32_t* spv_ptr = reinterpret_cast<const uint32_t*>(shaderc.result_get_bytes(result));
+        std::vector<std::uint32_t> spirv(spv_ptr, spv_ptr + shaderc.result_get_length(result)/sizeof(std::uint32_t));
+
+        shaderc.result_release(result);
+        shaderc.compile_options_release(options);
+
+        return spirv;
+    }
+}
 
 coopmat_benchmark_shader::coopmat_benchmark_shader(
         VkDevice device,
         std::string_view code_template,
-        VkComponentTypeKHR a_vk_type,
-        VkComponentTypeKHR b_vk_type,
-        VkComponentTypeKHR c_vk_type,
+        const VkCooperativeMatrixPropertiesKHR& cmprops,
         std::uint32_t subgroup_size,
         std::uint32_t insts_in_block,
-	std::uint32_t blocks_in_kernel)
+	std::uint32_t blocks_in_kernel,
+        const spirv_cache* cache)
+    : coopmat_benchmark_shader(
+            device,
+            compile(code_template,
+                    cmprops,
+                    subgroup_size, insts_in_block, blocks_in_kernel,
+                    cache),
+            subgroup_size)
+{
+}
+
+coopmat_benchmark_shader::coopmat_benchmark_shader(
+        VkDevice device,
+        const std::vector<std::uint32_t>& spirv,
+        std::uint32_t subgroup_size)
     : device(device),
       subgroup_size(subgroup_size)
 {
-    specialized_code = code_template;
+    VkShaderModuleCreateInfo smci{};
+    smci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    smci.pCode = spirv.data();
+    smci.codeSize = spirv.size()*sizeof(std::uint32_t);
 
+    if(VK_SUCCESS != vkCreateShaderModule(device, &smci, nullptr, &shader))
+    {
+        throw std::runtime_error("Failed to create shader module");
+    }
+}
+
+coopmat_benchmark_shader::macro_list coopmat_benchmark_shader::make_macros(
+        const VkCooperativeMatrixPropertiesKHR& cmprops,
+        std::uint32_t subgroup_size,
+        std::uint32_t insts_in_block,
+        std::uint32_t blocks_in_kernel,
+        std::uint32_t workgroup_subgroups)
+{
     using pss = std::pair<std::string, std::string>;
 
-    std::vector<pss> replacements
+    macro_list macros
     {
-        pss{"A_TYPE", component_type_to_glsl_type_str(a_vk_type)},
-        pss{"B_TYPE", component_type_to_glsl_type_str(b_vk_type)},
-        pss{"C_TYPE", component_type_to_glsl_type_str(c_vk_type)},
+        pss{"A_TYPE", component_type_to_glsl_type_str(cmprops.AType)},
+        pss{"B_TYPE", component_type_to_glsl_type_str(cmprops.BType)},
+        pss{"C_TYPE", component_type_to_glsl_type_str(cmprops.CType)},
+        pss{"D_TYPE", component_type_to_glsl_type_str(cmprops.ResultType)},
         pss{"INST_COUNT", fmt::format("{}", insts_in_block)},
         pss{"BLOCKS_IN_KERNEL", fmt::format("{}", blocks_in_kernel)},
         pss{"SUBGRP_SIZE", fmt::format("{}", subgroup_size)},
     };
+    // The operand only exists for integer accumulators
+    if(cmprops.saturatingAccumulation && !component_type_is_float(cmprops.ResultType))
+    {
+        macros.emplace_back("SATURATING", "1");
+    }
+    // Left out for a single subgroup, so the precompiled and cached variants of before still match
+    if(workgroup_subgroups != 1)
+    {
+        macros.emplace_back("WG_SUBGROUPS", fmt::format("{}", workgroup_subgroups));
+    }
+    if(cmprops.scope == VK_SCOPE_WORKGROUP_KHR)
+    {
+        macros.emplace_back("WORKGROUP_SCOPE", "1");
+    }
+    return macros;
+}
+
+std::vector<std::uint32_t> coopmat_benchmark_shader::compile(
+        std::string_view code_template,
+        const VkCooperativeMatrixPropertiesKHR& cmprops,
+        std::uint32_t subgroup_size,
+        std::uint32_t insts_in_block,
+        std::uint32_t blocks_in_kernel,
+        const spirv_cache* cache,
+        lazy_shaderc_compiler* compiler)
+{
+    return compile(code_template,
+            make_macros(cmprops, subgroup_size, insts_in_block, blocks_in_kernel),
+            cache, compiler);
+}
+
+std::vector<std::uint32_t> coopmat_benchmark_shader::compile(
+        std::string_view code_template,
+        const macro_list& macros,
+        const spirv_cache* cache,
+        lazy_shaderc_compiler* compiler)
+{
+    std::string specialized_code(code_template);
 
     // Actually just use shaderc s macro function
     // TODO: move to some snippet repo for reference
@@ -68,130 +195,155 @@ coopmat_benchmark_shader::coopmat_benchmark_shader(
     //    replace_all(specialized_code, search_for, val);
     //}
 
-    auto compiler = shaderc_compiler_initialize();
-    auto options = shaderc_compile_options_initialize();
-
-    for(const auto& kv : replacements)
+    // Built into the binary, neither the cache nor shaderc are needed
+    if(auto precompiled = find_precompiled_spirv(specialized_code, macros))
     {
-        const auto& key = std::get<0>(kv);
-        const auto& value = std::get<1>(kv);
-        shaderc_compile_options_add_macro_definition(
-                options,
-                key.data(), key.size(),
-                value.data(), value.size());
+        return std::vector<std::uint32_t>(precompiled->begin(), precompiled->end());
     }
 
-    shaderc_compile_options_set_optimization_level(options, shaderc_optimization_level_performance);
-    shaderc_compile_options_set_target_env(options, shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_3);
-
-    auto result = shaderc_compile_into_spv(
-            compiler, 
-            specialized_code.data(), specialized_code.size(), 
-            shaderc_compute_shader, "coopmat.comp.glsl", "main",
-            options);
-
-    if (shaderc_result_get_compilation_status(result) != shaderc_compilation_status_success)
+    std::vector<std::uint32_t> spirv;
+    std::uint64_t cache_key = 0;
+    if(cache)
     {
-        fmt::print("GLSL->SPIR-V compilation failed with: {}\n", shaderc_result_get_error_message(result));
-        throw std::runtime_error("GLSL to SPIR-V compilation failed");
+        cache_key = spirv_cache::make_key(
+                specialized_code, macros,
+                target_env, target_env_version, optimization_level);
+        if(auto cached = cache->load(cache_key))
+        {
+            spirv = std::move(*cached);
+        }
     }
 
-
-    const std::uint32_t* spv_ptr = reinterpret_cast<const uint32_t*>(shaderc_result_get_bytes(result));
-
-
-    VkShaderModuleCreateInfo smci{};
-    smci.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    smci.pCode = spv_ptr;
-    smci.codeSize = shaderc_result_get_length(result);
-
-    vkCreateShaderModule(device, &smci, nullptr, &shader);
-
-
-    shaderc_result_release(result);
-    shaderc_compile_options_release(options);
-    shaderc_compiler_release(compiler);
-}
-
-coopmat_benchmark_shader::configuration coopmat_benchmark_shader::create_configuration(VkDevice device)
-{
-    configuration config;
-
-    config.dslb = VkDescriptorSetLayoutBinding
-    {
-        .binding = 0,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-        .descriptorCount = 1,
-        .stageFlags = VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT,
-    };
-
-    VkDescriptorSetLayoutCreateInfo dslci
+    if(spirv.empty())
     {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = 1,
-        .pBindings = &config.dslb,
-    };
-
-    if(VK_SUCCESS != vkCreateDescriptorSetLayout(device, &dslci, nullptr, &config.dsl))
-    {
-        throw std::runtime_error("Failed to create descriptor set layout");
+        spirv = compile_spirv(specialized_code, macros, compiler);
+        if(cache)
+        {
+            cache->store(cache_key, spirv);
+        }
     }
 
-    VkPushConstantRange pcr
-    {
-        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-        .offset = 0,
-        .size = sizeof(uint32_t),
-    };
-
-    VkPipelineLayoutCreateInfo plci
-    {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &config.dsl,
-        .pushConstantRangeCount = 1,
-        .pPushConstantRanges = &pcr,
-    };
+    return spirv;
+}
 
-    if(VK_SUCCESS != vkCreatePipelineLayout(device, &plci, nullptr, &config.pl))
+void coopmat_benchmark_shader::add_binding_macros(macro_list& macros, address_binding binding)
+{
+    if(binding == address_binding::push_constant)
     {
-        throw std::runtime_error("Failed to create pipeline layout");
+        macros.emplace_back("PUSH_ADDRESSES", "1");
     }
+}
 
-    std::array<VkDescriptorPoolSize,1> sizes
-    {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}
-    };
-
-    VkDescriptorPoolCreateInfo dpci
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
-        .maxSets = 1,
-        .poolSizeCount = 1,
-        .pPoolSizes = sizes.data(),
-    };
+coopmat_benchmark_shader::configuration coopmat_benchmark_shader::create_configuration(VkDevice device, address_binding binding)
+{
+    configuration config;
+    config.binding = binding;
 
-    if(VK_SUCCESS != vkCreateDescriptorPool(device, &dpci, nullptr, &config.dp))
+    if(binding == address_binding::push_constant)
     {
-        throw std::runtime_error("Failed to create descriptor pool");
+        // Everything is in the push constants, no set layout, pool or set
+        config.dslb = VkDescriptorSetLayoutBinding{};
+        config.dsl = VK_NULL_HANDLE;
+        config.dp = VK_NULL_HANDLE;
+        config.ds = VK_NULL_HANDLE;
+
+        VkPushConstantRange pcr
+        {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(push_parameters),
+        };
+
+        VkPipelineLayoutCreateInfo plci
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = 0,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &pcr,
+        };
+
+        if(VK_SUCCESS != vkCreatePipelineLayout(device, &plci, nullptr, &config.pl))
+        {
+            throw std::runtime_error("Failed to create pipeline layout");
+        }
     }
-
-    VkDescriptorSetAllocateInfo dsai
-    {
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool = config.dp,
-        .descriptorSetCount = 1,
-        .pSetLayouts = &config.dsl,
-    };
-
-
-    if(VK_SUCCESS != vkAllocateDescriptorSets(device, &dsai, &config.ds))
+    else
     {
-        throw std::runtime_error("Failed to Allocate Descriptor Sets");
+        config.dslb = VkDescriptorSetLayoutBinding
+        {
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+            .stageFlags = VkShaderStageFlagBits::VK_SHADER_STAGE_COMPUTE_BIT,
+        };
+
+        VkDescriptorSetLayoutCreateInfo dslci
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+            .bindingCount = 1,
+            .pBindings = &config.dslb,
+        };
+
+        if(VK_SUCCESS != vkCreateDescriptorSetLayout(device, &dslci, nullptr, &config.dsl))
+        {
+            throw std::runtime_error("Failed to create descriptor set layout");
+        }
+
+        VkPushConstantRange pcr
+        {
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+            .offset = 0,
+            .size = sizeof(uint32_t),
+        };
+
+        VkPipelineLayoutCreateInfo plci
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+            .setLayoutCount = 1,
+            .pSetLayouts = &config.dsl,
+            .pushConstantRangeCount = 1,
+            .pPushConstantRanges = &pcr,
+        };
+
+        if(VK_SUCCESS != vkCreatePipelineLayout(device, &plci, nullptr, &config.pl))
+        {
+            throw std::runtime_error("Failed to create pipeline layout");
+        }
+
+        std::array<VkDescriptorPoolSize,1> sizes
+        {
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}
+        };
+
+        VkDescriptorPoolCreateInfo dpci
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+            .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+            .maxSets = 1,
+            .poolSizeCount = 1,
+            .pPoolSizes = sizes.data(),
+        };
+
+        if(VK_SUCCESS != vkCreateDescriptorPool(device, &dpci, nullptr, &config.dp))
+        {
+            throw std::runtime_error("Failed to create descriptor pool");
+        }
+
+        VkDescriptorSetAllocateInfo dsai
+        {
+            .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool = config.dp,
+            .descriptorSetCount = 1,
+            .pSetLayouts = &config.dsl,
+        };
+
+
+        if(VK_SUCCESS != vkAllocateDescriptorSets(device, &dsai, &config.ds))
+        {
+            throw std::runtime_error("Failed to Allocate Descriptor Sets");
+        }
     }
 
-
     // Not initializing this was the source of many errors
     // and static analysis tools didn't pick it up!
     config.si.dataSize = 0;
@@ -213,50 +365,104 @@ void coopmat_benchmark_shader::finalize(
         VkCooperativeMatrixPropertiesKHR cmprops,
         coopmat_benchmark_shader::configuration config)
 {
-    using std::bind, std::accumulate, std::bind, std::plus;
-    using namespace std::placeholders;
+    coopmat_benchmark_shader* self = this;
+    finalize_batch(std::span(&self, 1), std::span(&cmprops, 1), config);
+}
 
-    // TODO: this should be bound tighter to the array of VkSpecializationMapEntry
-    std::array<std::uint32_t,3> mnk_values
-    {
-        cmprops.MSize,
-        cmprops.NSize,
-        cmprops.KSize
-    };
-    config.si.pData = mnk_values.data();
-    
-    VkPipelineShaderStageRequiredSubgroupSizeCreateInfo pssrssc
+void coopmat_benchmark_shader::finalize_batch(
+        std::span<coopmat_benchmark_shader* const> shaders,
+        std::span<const VkCooperativeMatrixPropertiesKHR> cmprops,
+        coopmat_benchmark_shader::configuration config)
+{
+    const std::size_t count = shaders.size();
+    if(count == 0)
     {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO,
-        .requiredSubgroupSize = subgroup_size
-    };
-
-    VkPipelineShaderStageCreateInfo pssci
+        return;
+    }
+    if(count != cmprops.size())
     {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-        .pNext = &pssrssc,
-        .flags = VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT,
-        .stage = VK_SHADER_STAGE_COMPUTE_BIT,
-        .module = shader,
-        .pName = "main",
-        .pSpecializationInfo = &config.si,
-    };
+        throw std::runtime_error("Need exactly one VkCooperativeMatrixPropertiesKHR per shader");
+    }
 
-    VkComputePipelineCreateInfo cpci
+    // Everything the create infos point to has to stay alive until vkCreateComputePipelines returns
+    // TODO: this should be bound tighter to the array of VkSpecializationMapEntry
+    std::vector<std::array<std::uint32_t,3>> mnk_values(count);
+    std::vector<VkSpecializationInfo> sis(count, config.si);
+    std::vector<VkPipelineShaderStageRequiredSubgroupSizeCreateInfo> pssrsscis(count);
+    std::vector<VkPipelineCreationFeedback> pcfs(count);
+    std::vector<VkPipelineCreationFeedbackCreateInfo> pcfcis(count);
+    std::vector<VkComputePipelineCreateInfo> cpcis(count);
+    std::vector<VkPipeline> pipelines(count, VK_NULL_HANDLE);
+
+    for(std::size_t i = 0; i < count; i++)
     {
-        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
-        .pNext = nullptr,
-        .stage = pssci,
-        .layout = config.pl,
-    };
-
+        mnk_values[i] = {cmprops[i].MSize, cmprops[i].NSize, cmprops[i].KSize};
+        sis[i].pData = mnk_values[i].data();
+
+        pssrsscis[i] = VkPipelineShaderStageRequiredSubgroupSizeCreateInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_REQUIRED_SUBGROUP_SIZE_CREATE_INFO,
+            .requiredSubgroupSize = shaders[i]->subgroup_size
+        };
+
+        pcfs[i] = VkPipelineCreationFeedback{};
+        pcfcis[i] = VkPipelineCreationFeedbackCreateInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO,
+            .pPipelineCreationFeedback = &pcfs[i],
+        };
+
+        cpcis[i] = VkComputePipelineCreateInfo
+        {
+            .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .pNext = &pcfcis[i],
+            .stage = VkPipelineShaderStageCreateInfo
+            {
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .pNext = &pssrsscis[i],
+                .flags = VK_PIPELINE_SHADER_STAGE_CREATE_REQUIRE_FULL_SUBGROUPS_BIT,
+                .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+                .module = shaders[i]->shader,
+                .pName = "main",
+                .pSpecializationInfo = &sis[i],
+            },
+            .layout = config.pl,
+        };
+    }
 
+    auto device = shaders[0]->device;
 
-    auto result = vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &cpci, nullptr, &pipeline);
+    auto start = std::chrono::steady_clock::now();
+    auto result = vkCreateComputePipelines(device, config.pc, count, cpcis.data(), nullptr, pipelines.data());
+    auto end = std::chrono::steady_clock::now();
     if(VK_SUCCESS != result)
     {
+        // Some of them might have been created anyway
+        for(auto pipeline : pipelines)
+        {
+            vkDestroyPipeline(device, pipeline, nullptr);
+        }
         fmt::print("Error: {}\n",string_VkResult(result));
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
+    auto wall_nanoseconds = std::chrono::duration<double, std::nano>(end - start).count();
+    for(std::size_t i = 0; i < count; i++)
+    {
+        auto& shader = *shaders[i];
+        bool feedback_valid = pcfs[i].flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT;
+
+        shader.pipeline = pipelines[i];
+        shader.creation_cache_hit = feedback_valid &&
+            (pcfs[i].flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT);
+        // In a batch only the driver knows how long each pipeline took
+        if(count > 1 && feedback_valid)
+        {
+            shader.creation_nanoseconds = static_cast<double>(pcfs[i].duration);
+        }
+        else
+        {
+            shader.creation_nanoseconds = wall_nanoseconds/static_cast<double>(count);
+        }
+    }
 }
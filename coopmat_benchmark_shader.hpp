@@ -5,13 +5,40 @@
 
 #include <array>
 #include <cstdint>
+#include <span>
 #include <string>
 #include <string_view>
+#include <utility>
+#include <vector>
 
+class spirv_cache;
+class lazy_shaderc_compiler;
+
+// How the kernels get the A/B/C device addresses: through a UBO in a descriptor set,
+// or as push constants right behind params.n (templates compiled with PUSH_ADDRESSES)
+enum class address_binding
+{
+    descriptor,
+    push_constant,
+};
+
+// The push constant block of the templates with PUSH_ADDRESSES,
+// buffer references are 8 byte aligned in there
+struct push_parameters
+{
+    std::uint32_t n;
+    std::uint32_t padding;
+    VkDeviceAddress a;
+    VkDeviceAddress b;
+    VkDeviceAddress c;
+};
 
 class coopmat_benchmark_shader
 {
 public:
+    using macro_list = std::vector<std::pair<std::string, std::string>>;
+
+    // With address_binding::push_constant there is no descriptor set, dsl/dp/ds stay VK_NULL_HANDLE
     struct configuration
     {
         VkDescriptorSetLayoutBinding dslb;
@@ -21,18 +48,26 @@ public:
         VkPipelineLayout             pl;
         std::array<VkSpecializationMapEntry,3> smps;
         VkSpecializationInfo         si;
+        // Shared by all pipelines on the device, VK_NULL_HANDLE if caching is disabled
+        VkPipelineCache              pc = VK_NULL_HANDLE;
+        address_binding              binding = address_binding::descriptor;
     };
 
     coopmat_benchmark_shader(
             VkDevice device,
             std::string_view   code_template,
-            VkComponentTypeKHR a_vk_type,
-            VkComponentTypeKHR b_vk_type,
-            VkComponentTypeKHR c_vk_type,
+            const VkCooperativeMatrixPropertiesKHR& cmprops,
             std::uint32_t subgroup_size,
             std::uint32_t insts_in_block,
-            std::uint32_t blocks_in_kernel
+            std::uint32_t blocks_in_kernel,
+            // If set, SPIR-V is taken from/stored to this cache instead of always compiling
+            const spirv_cache* cache = nullptr
 	    );
+    // For SPIR-V that was compiled ahead of time with compile()
+    coopmat_benchmark_shader(
+            VkDevice device,
+            const std::vector<std::uint32_t>& spirv,
+            std::uint32_t subgroup_size);
     coopmat_benchmark_shader(
             const coopmat_benchmark_shader& other)
         :
@@ -48,13 +83,46 @@ public:
         //vkDestroyShaderModule(device, shader, nullptr);
     }
 
-    static configuration create_configuration(VkDevice device);
+    // GLSL->SPIR-V only, doesn't need a device, so it can run ahead of time on any thread.
+    // shaderc compilers shouldn't be shared between threads, pass one per thread
+    // (or nullptr to have a temporary one created). Precompiled and cached variants
+    // don't need shaderc, so it's only loaded when something actually gets compiled
+    static std::vector<std::uint32_t> compile(
+            std::string_view   code_template,
+            const VkCooperativeMatrixPropertiesKHR& cmprops,
+            std::uint32_t subgroup_size,
+            std::uint32_t insts_in_block,
+            std::uint32_t blocks_in_kernel,
+            const spirv_cache* cache = nullptr,
+            lazy_shaderc_compiler* compiler = nullptr);
+    // Same thing for any template, macros are passed to shaderc as -D
+    static std::vector<std::uint32_t> compile(
+            std::string_view   code_template,
+            const macro_list&  macros,
+            const spirv_cache* cache = nullptr,
+            lazy_shaderc_compiler* compiler = nullptr);
+    // The macros coopmat.comp.glsl.in expects for the types (and saturation and scope) of 'cmprops',
+    // with 'workgroup_subgroups' subgroups per workgroup
+    static macro_list make_macros(
+            const VkCooperativeMatrixPropertiesKHR& cmprops,
+            std::uint32_t subgroup_size,
+            std::uint32_t insts_in_block,
+            std::uint32_t blocks_in_kernel,
+            std::uint32_t workgroup_subgroups = 1);
+
+    // Adds what the templates need for 'binding' to their macros
+    static void add_binding_macros(macro_list& macros, address_binding binding);
+
+    static configuration create_configuration(VkDevice device, address_binding binding = address_binding::descriptor);
     static void release_configuration(VkDevice device, configuration config)
     {
         vkDestroyPipelineLayout(device, config.pl, nullptr);
-        vkFreeDescriptorSets(device, config.dp, 1, &config.ds);
-        vkDestroyDescriptorPool(device, config.dp, nullptr);
-        vkDestroyDescriptorSetLayout(device, config.dsl, nullptr);
+        if(config.binding == address_binding::descriptor)
+        {
+            vkFreeDescriptorSets(device, config.dp, 1, &config.ds);
+            vkDestroyDescriptorPool(device, config.dp, nullptr);
+            vkDestroyDescriptorSetLayout(device, config.dsl, nullptr);
+        }
     }
 
     void destroy_shared_module()
@@ -64,21 +132,40 @@ public:
 
     void finalize(VkCooperativeMatrixPropertiesKHR cmprops,
                   configuration config);
+    // Creates the pipelines of all shaders (which have to be on the same device)
+    // in a single vkCreateComputePipelines call
+    static void finalize_batch(
+            std::span<coopmat_benchmark_shader* const> shaders,
+            std::span<const VkCooperativeMatrixPropertiesKHR> cmprops,
+            configuration config);
     void release()
     {
         vkDestroyPipeline(device, pipeline, nullptr);
+        pipeline = VK_NULL_HANDLE;
     }
     VkPipeline get_pipeline()
     {
         return pipeline;
     }
+    // Wall clock time of the last vkCreateComputePipelines call in finalize()
+    double get_creation_nanoseconds() const
+    {
+        return creation_nanoseconds;
+    }
+    // As reported through VK_EXT_pipeline_creation_feedback (core in 1.3)
+    bool get_creation_cache_hit() const
+    {
+        return creation_cache_hit;
+    }
 private:
     VkDevice device;
     VkShaderModule shader;
-    VkPipeline pipeline;
+    VkPipeline pipeline = VK_NULL_HANDLE;
     std::string specialized_code;
 
     std::uint32_t subgroup_size;
 
+    double creation_nanoseconds = 0.0;
+    bool creation_cache_hit = false;
 };
 #endif /* ifndef COOPMAT_BENCHMARK_SHADER */
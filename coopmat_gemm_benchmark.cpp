@@ -0,0 +1,91 @@
+#include "coopmat_gemm_benchmark.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <fmt/format.h>
+
+#include <stdexcept>
+
+namespace
+{
+    std::uint32_t round_up(std::uint32_t value, std::uint32_t multiple)
+    {
+        return ((value + multiple - 1)/multiple)*multiple;
+    }
+}
+
+coopmat_gemm_benchmark::coopmat_gemm_benchmark(
+        VkPhysicalDevice phy_device,
+        VkDevice device,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        gemm_size size,
+        gemm_tiling tiling,
+        std::size_t outer_iterations)
+    : base_coopmat_benchmark(
+            phy_device,
+            device,
+            cmprops,
+            // insts_in_block, inner_iterations and num_groups don't mean much here,
+            // num_groups is set below once the size is known
+            1,
+            1,
+            outer_iterations,
+            1),
+      tiling(tiling),
+      block_m(tiling.wg_subgroups_m*tiling.sg_tiles_m*cmprops.MSize),
+      block_n(tiling.wg_subgroups_n*tiling.sg_tiles_n*cmprops.NSize),
+      block_k(tiling.bk_tiles*cmprops.KSize)
+{
+    if(block_m == 0 || block_n == 0 || block_k == 0)
+    {
+        throw std::runtime_error("Invalid GEMM tiling");
+    }
+    this->size = gemm_size
+    {
+        .m = round_up(size.m, block_m),
+        .n = round_up(size.n, block_n),
+        .k = round_up(size.k, block_k),
+    };
+    // One workgroup per block of C, num_groups counts subgroups like everywhere else
+    workgroup_subgroups = tiling.wg_subgroups_m*tiling.wg_subgroups_n;
+    num_groups = std::size_t{this->size.m/block_m}*(this->size.n/block_n)*workgroup_subgroups;
+}
+
+void coopmat_gemm_benchmark::create_buffers(const device_context& context)
+{
+    base_coopmat_benchmark::create_buffers(context,
+            std::size_t{size.m}*size.k*component_type_size(cmprops.AType),
+            std::size_t{size.k}*size.n*component_type_size(cmprops.BType),
+            std::size_t{size.m}*size.n*component_type_size(cmprops.CType));
+}
+
+std::uint32_t coopmat_gemm_benchmark::get_shared_memory_bytes() const
+{
+    return 2*(block_m*block_k*component_type_size(cmprops.AType) +
+              block_k*block_n*component_type_size(cmprops.BType));
+}
+
+coopmat_benchmark_shader::macro_list coopmat_gemm_benchmark::make_macros(std::uint32_t subgroup_size) const
+{
+    using pss = std::pair<std::string, std::string>;
+
+    return coopmat_benchmark_shader::macro_list
+    {
+        pss{"A_TYPE", component_type_to_glsl_type_str(cmprops.AType)},
+        pss{"B_TYPE", component_type_to_glsl_type_str(cmprops.BType)},
+        pss{"C_TYPE", component_type_to_glsl_type_str(cmprops.CType)},
+        pss{"SUBGRP_SIZE", fmt::format("{}", subgroup_size)},
+        pss{"WG_SUBGROUPS_M", fmt::format("{}u", tiling.wg_subgroups_m)},
+        pss{"WG_SUBGROUPS_N", fmt::format("{}u", tiling.wg_subgroups_n)},
+        pss{"SG_TILES_M", fmt::format("{}u", tiling.sg_tiles_m)},
+        pss{"SG_TILES_N", fmt::format("{}u", tiling.sg_tiles_n)},
+        pss{"BK_TILES", fmt::format("{}u", tiling.bk_tiles)},
+        pss{"GEMM_M", fmt::format("{}u", size.m)},
+        pss{"GEMM_N", fmt::format("{}u", size.n)},
+        pss{"GEMM_K", fmt::format("{}u", size.k)},
+    };
+}
+
+std::string coopmat_gemm_benchmark::get_name() const
+{
+    return fmt::format("gemm-{}x{}x{}", size.m, size.n, size.k);
+}
@@ -0,0 +1,71 @@
+#ifndef COOPMAT_GEMM_BENCHMARK
+#define COOPMAT_GEMM_BENCHMARK
+
+#include "coopmat_benchmark.hpp"
+#include "coopmat_benchmark_shader.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+
+// How a workgroup of the GEMM kernel is split up, see coopmat_gemm.comp.glsl.in
+struct gemm_tiling
+{
+    std::uint32_t wg_subgroups_m;
+    std::uint32_t wg_subgroups_n;
+    std::uint32_t sg_tiles_m;
+    std::uint32_t sg_tiles_n;
+    std::uint32_t bk_tiles;
+};
+
+struct gemm_size
+{
+    std::uint32_t m;
+    std::uint32_t n;
+    std::uint32_t k;
+};
+
+// A full C = A*B of a given problem size, built from the coopmat tile shape in cmprops,
+// instead of the same fragments over and over. Each dispatch is one GEMM
+class coopmat_gemm_benchmark : public base_coopmat_benchmark
+{
+public:
+    // The problem size gets rounded up to multiples of the block tile
+    coopmat_gemm_benchmark(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            gemm_size size,
+            gemm_tiling tiling,
+            std::size_t outer_iterations);
+    virtual ~coopmat_gemm_benchmark() = default;
+
+    virtual void create_buffers(const device_context& context);
+
+    virtual std::uint64_t get_ops_per_dispatch(std::uint32_t) const
+    {
+        return 2*std::uint64_t{size.m}*size.n*size.k;
+    }
+
+    coopmat_benchmark_shader::macro_list make_macros(std::uint32_t subgroup_size) const;
+
+    // Shared memory the kernel needs for its double buffered A and B blocks
+    std::uint32_t get_shared_memory_bytes() const;
+
+    // e.g. "gemm-4096x4096x4096", for the result records
+    std::string get_name() const;
+
+    auto get_size() const -> gemm_size
+    {
+        return size;
+    }
+private:
+    gemm_size size;
+    gemm_tiling tiling;
+    std::uint32_t block_m;
+    std::uint32_t block_n;
+    std::uint32_t block_k;
+};
+
+#endif /* ifndef COOPMAT_GEMM_BENCHMARK */
@@ -0,0 +1,118 @@
+// Build time helper: compiles the mma shader variants a plain run is most likely to ask for
+// and writes them out as the table precompiled_spirv.cpp includes.
+// Usage: coopmat_precompile <output.inc> <subgroup sizes, comma separated>
+#include "coopmat_benchmark.hpp"
+#include "coopmat_benchmark_shader.hpp"
+#include "embedded_templates.hpp"
+#include "precompiled_spirv.hpp"
+#include "shaderc_loader.hpp"
+
+#include <fmt/format.h>
+#include <fmt/os.h>
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    struct type_combination
+    {
+        VkComponentTypeKHR a;
+        VkComponentTypeKHR b;
+        VkComponentTypeKHR c;
+        VkComponentTypeKHR d;
+    };
+
+    // What pretty much every device with VK_KHR_cooperative_matrix reports
+    constexpr std::array<type_combination, 4> common_types
+    {{
+        {VK_COMPONENT_TYPE_FLOAT16_KHR, VK_COMPONENT_TYPE_FLOAT16_KHR, VK_COMPONENT_TYPE_FLOAT16_KHR, VK_COMPONENT_TYPE_FLOAT16_KHR},
+        {VK_COMPONENT_TYPE_FLOAT16_KHR, VK_COMPONENT_TYPE_FLOAT16_KHR, VK_COMPONENT_TYPE_FLOAT32_KHR, VK_COMPONENT_TYPE_FLOAT32_KHR},
+        {VK_COMPONENT_TYPE_SINT8_KHR, VK_COMPONENT_TYPE_SINT8_KHR, VK_COMPONENT_TYPE_SINT32_KHR, VK_COMPONENT_TYPE_SINT32_KHR},
+        {VK_COMPONENT_TYPE_UINT8_KHR, VK_COMPONENT_TYPE_UINT8_KHR, VK_COMPONENT_TYPE_UINT32_KHR, VK_COMPONENT_TYPE_UINT32_KHR},
+    }};
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc != 3)
+    {
+        fmt::print("Usage: {} <output.inc> <subgroup sizes, comma separated>\n", argv[0]);
+        return -1;
+    }
+
+    auto code_template = find_embedded_template("coopmat.comp.glsl.in");
+    if(!code_template)
+    {
+        fmt::print("coopmat.comp.glsl.in isn't embedded\n");
+        return -1;
+    }
+
+    std::vector<std::uint32_t> subgroup_sizes;
+    std::stringstream list_stream(argv[2]);
+    std::string size_str;
+    while(std::getline(list_stream, size_str, ','))
+    {
+        subgroup_sizes.push_back(static_cast<std::uint32_t>(std::stoul(size_str)));
+    }
+
+    // The same macros main() ends up with for the default tuning, in the same order,
+    // otherwise the keys won't match
+    std::vector<coopmat_benchmark_shader::macro_list> variants;
+    for(const auto& types : common_types)
+    for(auto subgroup_size : subgroup_sizes)
+    for(auto binding : {address_binding::descriptor, address_binding::push_constant})
+    {
+        VkCooperativeMatrixPropertiesKHR cmprops
+        {
+            .sType = VK_STRUCTURE_TYPE_COOPERATIVE_MATRIX_PROPERTIES_KHR,
+            .AType = types.a,
+            .BType = types.b,
+            .CType = types.c,
+            .ResultType = types.d,
+            .saturatingAccumulation = VK_FALSE,
+            .scope = VK_SCOPE_SUBGROUP_KHR,
+        };
+        auto macros = coopmat_benchmark_shader::make_macros(
+                cmprops, subgroup_size, default_tuning.insts_in_block, default_tuning.blocks_in_kernel);
+        coopmat_benchmark_shader::add_binding_macros(macros, binding);
+        variants.push_back(std::move(macros));
+    }
+
+    try
+    {
+        lazy_shaderc_compiler compiler;
+        auto out = fmt::output_file(argv[1]);
+        out.print("// Generated by coopmat_precompile, don't edit\n");
+        for(std::size_t i = 0; i < variants.size(); i++)
+        {
+            auto spirv = coopmat_benchmark_shader::compile(*code_template, variants[i], nullptr, &compiler);
+            out.print("    constexpr std::uint32_t spirv_{}[] =\n    {{", i);
+            for(std::size_t word = 0; word < spirv.size(); word++)
+            {
+                out.print("{}0x{:08x},", (word % 8 == 0) ? "\n            " : "", spirv[word]);
+            }
+            out.print("\n    }};\n");
+        }
+        out.print("    constexpr std::array<precompiled_entry, {}> precompiled_entries\n    {{{{\n", variants.size());
+        for(std::size_t i = 0; i < variants.size(); i++)
+        {
+            out.print("        {{0x{:016x}ull, spirv_{}, std::size(spirv_{})}},\n",
+                    make_precompiled_spirv_key(*code_template, variants[i]), i, i);
+        }
+        out.print("    }}}};\n");
+    }
+    catch(const std::exception& e)
+    {
+        fmt::print("Precompiling SPIR-V failed: {}\n", e.what());
+        return -1;
+    }
+
+    fmt::print("Precompiled {} shader variants\n", variants.size());
+    return 0;
+}
@@ -0,0 +1,389 @@
+#include "coopmat_transfer_benchmark.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <fmt/format.h>
+#include <vulkan/vk_enum_string_helper.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <span>
+#include <stdexcept>
+
+namespace
+{
+    // Submits one command buffer per queue, each signalling its own fence, waits for all
+    // of them and returns the host side time that took
+    double submit_and_wait(VkDevice device,
+            std::span<const VkQueue> queues,
+            std::span<const VkCommandBuffer> command_buffers,
+            std::span<const VkFence> fences)
+    {
+        vkResetFences(device, fences.size(), fences.data());
+        auto start = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < queues.size(); i++)
+        {
+            VkSubmitInfo si
+            {
+                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .commandBufferCount = 1,
+                .pCommandBuffers = &command_buffers[i],
+            };
+            if(VK_SUCCESS != vkQueueSubmit(queues[i], 1, &si, fences[i]))
+            {
+                throw std::runtime_error("Failed submitting command buffer to queue");
+            }
+        }
+        VkResult result = vkWaitForFences(device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+        while((result == VK_TIMEOUT) || (result == VK_NOT_READY))
+        {
+            fmt::print("Timed out, waiting again\n");
+            result = vkWaitForFences(device, fences.size(), fences.data(), VK_TRUE, UINT64_MAX);
+        }
+        if(VK_SUCCESS != result)
+        {
+            fmt::print("Error waiting for queues: {}\n", string_VkResult(result));
+            throw std::runtime_error("Failed waiting for queues");
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+
+    std::string format_bytes(std::uint64_t bytes)
+    {
+        if(bytes >= (1ull << 30) && bytes % (1ull << 30) == 0) return fmt::format("{}G", bytes >> 30);
+        if(bytes >= (1ull << 20) && bytes % (1ull << 20) == 0) return fmt::format("{}M", bytes >> 20);
+        if(bytes >= (1ull << 10) && bytes % (1ull << 10) == 0) return fmt::format("{}K", bytes >> 10);
+        return fmt::format("{}", bytes);
+    }
+}
+
+coopmat_transfer_benchmark::coopmat_transfer_benchmark(
+        VkPhysicalDevice phy_device,
+        VkDevice device,
+        VkCooperativeMatrixPropertiesKHR cmprops,
+        std::vector<std::uint64_t> sizes,
+        std::size_t insts_in_block,
+        std::size_t inner_iterations,
+        std::size_t outer_iterations,
+        std::size_t num_groups)
+    : base_coopmat_benchmark(
+            phy_device,
+            device,
+            cmprops,
+            insts_in_block,
+            inner_iterations,
+            outer_iterations,
+            num_groups),
+      sizes(std::move(sizes))
+{
+    // vkCmdCopyBuffer can't do 0 bytes
+    std::erase(this->sizes, 0);
+    if(this->sizes.empty())
+    {
+        throw std::runtime_error("Transfer benchmark needs at least one size");
+    }
+    std::sort(this->sizes.begin(), this->sizes.end());
+    max_size = this->sizes.back();
+
+    const std::size_t a_element_size = component_type_size(cmprops.AType);
+    const std::size_t b_element_size = component_type_size(cmprops.BType);
+    const std::size_t c_element_size = component_type_size(cmprops.CType);
+    if(a_element_size == 0 || b_element_size == 0 || c_element_size == 0)
+    {
+        throw std::runtime_error("Unknown component type size");
+    }
+    a_kernel_bytes = num_groups*a_element_size*cmprops.MSize*cmprops.KSize;
+    b_kernel_bytes = num_groups*b_element_size*cmprops.KSize*cmprops.NSize;
+    c_kernel_bytes = num_groups*c_element_size*cmprops.MSize*cmprops.NSize*insts_in_block;
+}
+
+void coopmat_transfer_benchmark::create_buffers(const device_context& context)
+{
+    // Uploads go into the back of a, downloads come from the back of c,
+    // so the copies never touch what the kernel works on during the overlap test
+    base_coopmat_benchmark::create_buffers(context,
+            a_kernel_bytes + max_size,
+            b_kernel_bytes,
+            c_kernel_bytes + max_size);
+}
+
+benchmark_result coopmat_transfer_benchmark::time_copies(
+        device_context& context,
+        std::size_t queue_index,
+        bool upload,
+        std::uint64_t bytes)
+{
+    const std::size_t count = outer_iterations;
+    const auto timestamp_period = context.get_timestamp_period();
+
+    VkQueryPoolCreateInfo qpci
+    {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = static_cast<std::uint32_t>(2*count),
+    };
+    VkQueryPool query_pool;
+    if(VK_SUCCESS != vkCreateQueryPool(device, &qpci, nullptr, &query_pool))
+    {
+        throw std::runtime_error("Failed to create query pool");
+    }
+    VkFenceCreateInfo fci
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    VkFence fence;
+    if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+    {
+        vkDestroyQueryPool(device, query_pool, nullptr);
+        throw std::runtime_error("Failed to create fence");
+    }
+
+    std::vector<std::uint64_t> timestamps(2*count);
+    try
+    {
+        VkCommandBufferBeginInfo cbbi
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+
+        // vkCmdResetQueryPool isn't allowed on transfer-only queues, so that goes to the compute queue first
+        auto reset_buffer = context.get_command_buffer(0, 0);
+        vkBeginCommandBuffer(reset_buffer, &cbbi);
+        vkCmdResetQueryPool(reset_buffer, query_pool, 0, 2*count);
+        vkEndCommandBuffer(reset_buffer);
+        std::array queue{context.get_queue(0)};
+        submit_and_wait(device, queue, std::array{reset_buffer}, std::array{fence});
+
+        VkBufferCopy region
+        {
+            .srcOffset = upload ? a_kernel_bytes : c_kernel_bytes,
+            .dstOffset = upload ? a_kernel_bytes : c_kernel_bytes,
+            .size = bytes,
+        };
+        VkBuffer src = upload ? a_host_buffer : c_buffer;
+        VkBuffer dst = upload ? a_buffer : c_host_buffer;
+
+        // Every copy has to be done before the next one starts, otherwise we'd time the queueing
+        VkMemoryBarrier mb
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        };
+
+        auto command_buffer = context.get_command_buffer(0, queue_index);
+        vkBeginCommandBuffer(command_buffer, &cbbi);
+        // One untimed copy first, for first-touch page faults and IOMMU mappings
+        vkCmdCopyBuffer(command_buffer, src, dst, 1, &region);
+        for(std::size_t i = 0; i < count; i++)
+        {
+            vkCmdPipelineBarrier(command_buffer,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    0, 1, &mb, 0, nullptr, 0, nullptr);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, query_pool, i*2+0);
+            vkCmdCopyBuffer(command_buffer, src, dst, 1, &region);
+            vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, i*2+1);
+        }
+        vkEndCommandBuffer(command_buffer);
+        queue[0] = context.get_queue(queue_index);
+        submit_and_wait(device, queue, std::array{command_buffer}, std::array{fence});
+
+        vkGetQueryPoolResults(device, query_pool, 0, 2*count, timestamps.size()*sizeof(std::uint64_t), timestamps.data(), sizeof(std::uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    }
+    catch(...)
+    {
+        vkDeviceWaitIdle(device);
+        vkDestroyFence(device, fence, nullptr);
+        vkDestroyQueryPool(device, query_pool, nullptr);
+        throw;
+    }
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroyQueryPool(device, query_pool, nullptr);
+
+    std::vector<double> durations(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        durations[i] = static_cast<double>(timestamps[2*i+1] - timestamps[2*i+0])*timestamp_period;
+    }
+    auto stats = compute_timing_statistics(durations, measurement.statistics);
+
+    return benchmark_result
+    {
+        .min_nanoseconds = stats.raw_min,
+        .avg_nanoseconds = stats.raw_mean,
+        .max_gops_per_sec = 0.0,
+        .avg_gops_per_sec = 0.0,
+        .pipeline_creation_nanoseconds = 0.0,
+        .pipeline_cache_hit = false,
+        .timestamps = std::move(timestamps),
+        .timestamp_period = timestamp_period,
+        .ops = 0,
+        .bytes = bytes,
+        .statistics = stats,
+        // A single copy, we don't check whether that was enough
+        .warmup_iterations = 1,
+        .warmup_settled = false,
+    };
+}
+
+transfer_overlap coopmat_transfer_benchmark::time_overlap(device_context& context, std::size_t transfer_queue_index)
+{
+    const auto& config = context.get_configuration();
+    if(VK_NULL_HANDLE == shader->get_pipeline())
+    {
+        shader->finalize(cmprops, config);
+    }
+    update_descriptors(config);
+
+    // The copies and the kernel work on different parts of the buffers at the same time,
+    // create_buffers() made them concurrent between the compute and the transfer family
+    std::array<VkFence, 2> fences{VK_NULL_HANDLE, VK_NULL_HANDLE};
+    auto destroy_fences = [&]()
+    {
+        for(auto fence : fences)
+        {
+            vkDestroyFence(device, fence, nullptr);
+        }
+    };
+
+    try
+    {
+        VkFenceCreateInfo fci
+        {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        };
+        for(auto& fence : fences)
+        {
+            if(VK_SUCCESS != vkCreateFence(device, &fci, nullptr, &fence))
+            {
+                throw std::runtime_error("Failed to create fence");
+            }
+        }
+
+        VkCommandBufferBeginInfo cbbi
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        };
+
+        auto compute_buffer = context.get_command_buffer(0, 0);
+        std::uint32_t gpu_n = static_cast<std::uint32_t>(inner_iterations);
+        vkBeginCommandBuffer(compute_buffer, &cbbi);
+        bind_kernel(compute_buffer, config, gpu_n);
+        for(std::size_t i = 0; i < outer_iterations; i++)
+        {
+            vkCmdDispatch(compute_buffer, get_dispatch_groups(), 1, 1);
+        }
+        vkEndCommandBuffer(compute_buffer);
+
+        // An upload and a download of max_size each per round
+        auto copy_buffer = context.get_command_buffer(0, transfer_queue_index);
+        auto record_copies = [&](std::size_t rounds)
+        {
+            VkBufferCopy upload_region{ .srcOffset = a_kernel_bytes, .dstOffset = a_kernel_bytes, .size = max_size };
+            VkBufferCopy download_region{ .srcOffset = c_kernel_bytes, .dstOffset = c_kernel_bytes, .size = max_size };
+            vkResetCommandBuffer(copy_buffer, 0);
+            vkBeginCommandBuffer(copy_buffer, &cbbi);
+            for(std::size_t i = 0; i < rounds; i++)
+            {
+                vkCmdCopyBuffer(copy_buffer, a_host_buffer, a_buffer, 1, &upload_region);
+                vkCmdCopyBuffer(copy_buffer, c_buffer, c_host_buffer, 1, &download_region);
+            }
+            vkEndCommandBuffer(copy_buffer);
+        };
+
+        const std::array compute_queue{context.get_queue(0)};
+        const std::array transfer_queue{context.get_queue(transfer_queue_index)};
+        const std::array both_queues{context.get_queue(0), context.get_queue(transfer_queue_index)};
+
+        // Once untimed for both, then size the copies so they take about as long as the kernels,
+        // that way there is as much to hide on either side
+        submit_and_wait(device, compute_queue, std::array{compute_buffer}, std::span(fences).first(1));
+        double compute_nanoseconds = submit_and_wait(device, compute_queue, std::array{compute_buffer}, std::span(fences).first(1));
+        record_copies(1);
+        submit_and_wait(device, transfer_queue, std::array{copy_buffer}, std::span(fences).first(1));
+        double round_nanoseconds = submit_and_wait(device, transfer_queue, std::array{copy_buffer}, std::span(fences).first(1));
+        std::size_t rounds = std::clamp<std::size_t>(
+                static_cast<std::size_t>(std::llround(compute_nanoseconds/std::max(round_nanoseconds, 1.0))), 1, 1000);
+        record_copies(rounds);
+
+        transfer_overlap overlap
+        {
+            .copy_bytes = 2*max_size*rounds,
+            .compute_nanoseconds = compute_nanoseconds,
+            .copy_nanoseconds = submit_and_wait(device, transfer_queue, std::array{copy_buffer}, std::span(fences).first(1)),
+            .overlapped_nanoseconds = submit_and_wait(device, both_queues, std::array{compute_buffer, copy_buffer}, fences),
+        };
+        destroy_fences();
+        return overlap;
+    }
+    catch(...)
+    {
+        // Don't destroy anything that might still be in flight
+        vkDeviceWaitIdle(device);
+        destroy_fences();
+        throw;
+    }
+}
+
+transfer_result coopmat_transfer_benchmark::run_transfer(device_context& context, std::uint32_t blocks_in_kernel)
+{
+    transfer_result result{ .transfer_queue = false };
+
+    // The copy engines sit behind the transfer-only queue, that's the interesting one
+    std::size_t copy_queue = 0;
+    auto transfer_queue_index = context.get_transfer_queue_index();
+    if(transfer_queue_index && context.get_timestamp_valid_bits(*transfer_queue_index) > 0)
+    {
+        copy_queue = *transfer_queue_index;
+        result.transfer_queue = true;
+    }
+    else if(transfer_queue_index)
+    {
+        fmt::print("Transfer-only queue has no timestamps, timing copies on the compute queue\n");
+    }
+
+    fmt::print("Copies between host staging and device local buffers on the {} queue (family {}):\n",
+            result.transfer_queue ? "transfer" : "compute", context.get_queue_family_index(copy_queue));
+    for(auto bytes : sizes)
+    {
+        transfer_timing timing
+        {
+            .bytes = bytes,
+            .upload = time_copies(context, copy_queue, true, bytes),
+            .download = time_copies(context, copy_queue, false, bytes),
+        };
+        // bytes/ns == GB/s
+        fmt::print("    {:>6}: upload {:8.2f} GB/s ({:.0f} ns), download {:8.2f} GB/s ({:.0f} ns)\n",
+                format_bytes(bytes),
+                static_cast<double>(bytes)/timing.upload.statistics.median, timing.upload.statistics.median,
+                static_cast<double>(bytes)/timing.download.statistics.median, timing.download.statistics.median);
+        result.sizes.push_back(std::move(timing));
+    }
+    // Sizes are sorted, the smallest copy is mostly latency
+    fmt::print("Latency ({} copy): upload {:.0f} ns, download {:.0f} ns\n",
+            format_bytes(result.sizes.front().bytes),
+            result.sizes.front().upload.statistics.median,
+            result.sizes.front().download.statistics.median);
+
+    if(transfer_queue_index)
+    {
+        auto overlap = time_overlap(context, *transfer_queue_index);
+        auto ops = static_cast<double>(get_ops_per_dispatch(blocks_in_kernel)*outer_iterations);
+        fmt::print("Copy/compute overlap ({} of copies against {} dispatches):\n",
+                format_bytes(overlap.copy_bytes), outer_iterations);
+        fmt::print("    compute alone {:.0f} ns ({:.2f} GOP/s), copies alone {:.0f} ns ({:.2f} GB/s)\n",
+                overlap.compute_nanoseconds, ops/overlap.compute_nanoseconds,
+                overlap.copy_nanoseconds, static_cast<double>(overlap.copy_bytes)/overlap.copy_nanoseconds);
+        fmt::print("    together {:.0f} ns, {:.0f}% of the shorter one hidden\n",
+                overlap.overlapped_nanoseconds, 100.0*overlap.hidden_fraction());
+        result.overlap = overlap;
+    }
+    else
+    {
+        fmt::print("No transfer-only queue, skipping copy/compute overlap\n");
+    }
+    return result;
+}
@@ -0,0 +1,87 @@
+#ifndef COOPMAT_TRANSFER_BENCHMARK
+#define COOPMAT_TRANSFER_BENCHMARK
+
+#include "coopmat_benchmark.hpp"
+#include "device_context.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct transfer_timing
+{
+    std::uint64_t bytes;
+    // host -> device and device -> host, bytes per copy
+    benchmark_result upload;
+    benchmark_result download;
+};
+
+// Host side wall clock times, the queues involved don't share a timestamp domain
+struct transfer_overlap
+{
+    std::uint64_t copy_bytes;
+    double compute_nanoseconds;
+    double copy_nanoseconds;
+    double overlapped_nanoseconds;
+
+    // 1 means the shorter of the two was completely hidden behind the other one
+    double hidden_fraction() const
+    {
+        double shorter = std::min(compute_nanoseconds, copy_nanoseconds);
+        return (shorter > 0.0) ? (compute_nanoseconds + copy_nanoseconds - overlapped_nanoseconds)/shorter : 0.0;
+    }
+};
+
+struct transfer_result
+{
+    // Whether the copies were timed on a transfer-only queue or on the compute queue
+    bool transfer_queue;
+    std::vector<transfer_timing> sizes;
+    // Only with a transfer-only queue
+    std::optional<transfer_overlap> overlap;
+};
+
+// Times vkCmdCopyBuffer between the host staging buffers and the device local ones,
+// which is the PCIe (or NVLink-C2C) path on discrete GPUs.
+// The overlap part runs the mma kernel of 'cmprops' on the compute queue while
+// the transfer queue copies, so it needs the usual mma shader and tuning.
+class coopmat_transfer_benchmark : public base_coopmat_benchmark
+{
+public:
+    coopmat_transfer_benchmark(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            VkCooperativeMatrixPropertiesKHR cmprops,
+            std::vector<std::uint64_t> sizes,
+            std::size_t insts_in_block,
+            std::size_t inner_iterations,
+            std::size_t outer_iterations,
+            std::size_t num_groups);
+    virtual ~coopmat_transfer_benchmark() = default;
+
+    virtual void create_buffers(const device_context& context);
+
+    transfer_result run_transfer(device_context& context, std::uint32_t blocks_in_kernel);
+
+    auto get_sizes() const -> const std::vector<std::uint64_t>&
+    {
+        return sizes;
+    }
+private:
+    // Copies of 'bytes' behind what the kernel uses, timed with timestamps on 'queue_index'
+    benchmark_result time_copies(device_context& context, std::size_t queue_index, bool upload, std::uint64_t bytes);
+    transfer_overlap time_overlap(device_context& context, std::size_t transfer_queue_index);
+
+    std::vector<std::uint64_t> sizes;
+    std::uint64_t max_size;
+    // What the mma kernel touches at the start of a and c, copies go behind that
+    std::size_t a_kernel_bytes;
+    std::size_t b_kernel_bytes;
+    std::size_t c_kernel_bytes;
+};
+
+#endif /* ifndef COOPMAT_TRANSFER_BENCHMARK */
@@ -0,0 +1,137 @@
+#include "device_context.hpp"
+
+#include <stdexcept>
+
+device_context::device_context(
+        VkPhysicalDevice phy_device,
+        VkDevice device,
+        std::span<const VkDeviceQueueCreateInfo> dqcis,
+        std::optional<std::uint32_t> transfer_family,
+        address_binding binding)
+    : phy_device(phy_device),
+      device(device)
+{
+    if(dqcis.empty())
+    {
+        throw std::runtime_error("Device context needs at least one queue");
+    }
+
+    VkPhysicalDeviceSubgroupSizeControlProperties pdsgscp
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_SIZE_CONTROL_PROPERTIES,
+    };
+    VkPhysicalDeviceVulkan11Properties pdv11p
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_PROPERTIES,
+        .pNext = &pdsgscp,
+    };
+    VkPhysicalDeviceProperties2 pdp
+    {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &pdv11p,
+    };
+    vkGetPhysicalDeviceProperties2(phy_device, &pdp);
+    properties = pdp.properties;
+    subgroup_size = pdv11p.subgroupSize;
+    min_subgroup_size = pdsgscp.minSubgroupSize;
+    max_subgroup_size = pdsgscp.maxSubgroupSize;
+
+    vkGetPhysicalDeviceMemoryProperties(phy_device, &memory_properties);
+    arena = std::make_unique<memory_arena>(device, memory_properties);
+
+    std::uint32_t family_count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties2(phy_device, &family_count, nullptr);
+    std::vector<VkQueueFamilyProperties2> qfps(family_count);
+    for(auto& qfp : qfps){qfp.sType = VK_STRUCTURE_TYPE_QUEUE_FAMILY_PROPERTIES_2;}
+    vkGetPhysicalDeviceQueueFamilyProperties2(phy_device, &family_count, qfps.data());
+
+    auto add_queue = [&](std::uint32_t family_index, std::uint32_t index_in_family)
+    {
+        queue_slot slot
+        {
+            .family_index = family_index,
+            .index_in_family = index_in_family,
+            .timestamp_valid_bits = qfps[family_index].queueFamilyProperties.timestampValidBits,
+        };
+        vkGetDeviceQueue(device, family_index, index_in_family, &slot.queue);
+
+        VkCommandPoolCreateInfo cpci
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+            // Command buffers get re-recorded for every benchmark (and every tuning candidate)
+            .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+            .queueFamilyIndex = family_index,
+        };
+        if(VK_SUCCESS != vkCreateCommandPool(device, &cpci, nullptr, &slot.command_pool))
+        {
+            for(auto& created : queues)
+            {
+                vkDestroyCommandPool(device, created.command_pool, nullptr);
+            }
+            throw std::runtime_error("Failed to create command pool");
+        }
+        queues.push_back(std::move(slot));
+    };
+
+    for(const auto& dqci : dqcis)
+    {
+        for(std::uint32_t i = 0; i < dqci.queueCount; i++)
+        {
+            add_queue(dqci.queueFamilyIndex, i);
+        }
+    }
+    compute_queue_count = queues.size();
+    if(transfer_family)
+    {
+        add_queue(*transfer_family, 0);
+    }
+
+    configuration = coopmat_benchmark_shader::create_configuration(device, binding);
+}
+
+device_context::~device_context()
+{
+    for(auto& slot : queues)
+    {
+        if(!slot.command_buffers.empty())
+        {
+            vkFreeCommandBuffers(device, slot.command_pool, slot.command_buffers.size(), slot.command_buffers.data());
+        }
+        vkDestroyCommandPool(device, slot.command_pool, nullptr);
+    }
+    coopmat_benchmark_shader::release_configuration(device, configuration);
+}
+
+void device_context::enable_pipeline_cache(const std::filesystem::path& directory)
+{
+    cache = std::make_unique<pipeline_cache>(phy_device, device, directory);
+    configuration.pc = cache->get();
+}
+
+VkCommandBuffer device_context::get_command_buffer(std::size_t index, std::size_t queue_index)
+{
+    auto& slot = queues.at(queue_index);
+    auto& command_buffers = slot.command_buffers;
+    if(index >= command_buffers.size())
+    {
+        auto first_new = command_buffers.size();
+        command_buffers.resize(index + 1);
+        VkCommandBufferAllocateInfo cbai
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = slot.command_pool,
+            .level = VkCommandBufferLevel::VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = static_cast<std::uint32_t>(command_buffers.size() - first_new),
+        };
+        if(VK_SUCCESS != vkAllocateCommandBuffers(device, &cbai, command_buffers.data() + first_new))
+        {
+            command_buffers.resize(first_new);
+            throw std::runtime_error("Failed to allocate command buffers");
+        }
+        return command_buffers[index];
+    }
+
+    auto command_buffer = command_buffers[index];
+    vkResetCommandBuffer(command_buffer, 0);
+    return command_buffer;
+}
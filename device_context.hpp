@@ -0,0 +1,166 @@
+#ifndef DEVICE_CONTEXT
+#define DEVICE_CONTEXT
+
+#include "coopmat_benchmark_shader.hpp"
+#include "memory_arena.hpp"
+#include "pipeline_cache.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Everything that lives as long as the VkDevice and is shared by all benchmarks on it,
+// so running a benchmark only costs the actual GPU work.
+// Doesn't own the VkDevice itself, destroy the context before the device.
+class device_context
+{
+public:
+    // Gets every queue requested in 'dqcis', the first one is the one used for normal benchmarking.
+    // If 'transfer_family' is set, queue 0 of that family was created as well and is kept
+    // apart from the compute queues (it can't dispatch anything).
+    // 'binding' decides how the kernels get their buffer addresses, the shaders have to be compiled to match
+    device_context(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            std::span<const VkDeviceQueueCreateInfo> dqcis,
+            std::optional<std::uint32_t> transfer_family = std::nullopt,
+            address_binding binding = address_binding::descriptor);
+    device_context(const device_context&) = delete;
+    device_context& operator=(const device_context&) = delete;
+    ~device_context();
+
+    // Creates pipelines through a VkPipelineCache that's persisted in 'directory'
+    void enable_pipeline_cache(const std::filesystem::path& directory);
+
+    // Resets and returns command buffer 'index' of queue 'queue_index', allocating it on first use
+    VkCommandBuffer get_command_buffer(std::size_t index = 0, std::size_t queue_index = 0);
+
+    // Compute capable queues only
+    auto get_queue_count() const -> std::size_t
+    {
+        return compute_queue_count;
+    }
+
+    // Index of the transfer-only queue for the queue_index arguments, if there is one
+    auto get_transfer_queue_index() const -> std::optional<std::size_t>
+    {
+        if(queues.size() > compute_queue_count)
+        {
+            return compute_queue_count;
+        }
+        return std::nullopt;
+    }
+
+    auto get_phy_device() const -> VkPhysicalDevice
+    {
+        return phy_device;
+    }
+
+    auto get_device() const -> VkDevice
+    {
+        return device;
+    }
+
+    auto get_queue(std::size_t queue_index = 0) const -> VkQueue
+    {
+        return queues[queue_index].queue;
+    }
+
+    auto get_queue_family_index(std::size_t queue_index = 0) const -> std::uint32_t
+    {
+        return queues[queue_index].family_index;
+    }
+
+    // Index of the queue inside its family
+    auto get_queue_index_in_family(std::size_t queue_index) const -> std::uint32_t
+    {
+        return queues[queue_index].index_in_family;
+    }
+
+    // 0 if the queue doesn't support timestamps
+    auto get_timestamp_valid_bits(std::size_t queue_index = 0) const -> std::uint32_t
+    {
+        return queues[queue_index].timestamp_valid_bits;
+    }
+
+    auto get_configuration() const -> const coopmat_benchmark_shader::configuration&
+    {
+        return configuration;
+    }
+
+    // Where all benchmark buffers on this device get their memory from
+    auto get_memory_arena() const -> memory_arena&
+    {
+        return *arena;
+    }
+
+    // nullptr if not enabled
+    auto get_pipeline_cache() const -> pipeline_cache*
+    {
+        return cache.get();
+    }
+
+    auto get_properties() const -> const VkPhysicalDeviceProperties&
+    {
+        return properties;
+    }
+
+    auto get_timestamp_period() const -> float
+    {
+        return properties.limits.timestampPeriod;
+    }
+
+    auto get_memory_properties() const -> const VkPhysicalDeviceMemoryProperties&
+    {
+        return memory_properties;
+    }
+
+    auto get_subgroup_size() const -> std::uint32_t
+    {
+        return subgroup_size;
+    }
+
+    auto get_min_subgroup_size() const -> std::uint32_t
+    {
+        return min_subgroup_size;
+    }
+
+    auto get_max_subgroup_size() const -> std::uint32_t
+    {
+        return max_subgroup_size;
+    }
+private:
+    // Every queue gets its own pool, so they can be recorded for from different threads
+    struct queue_slot
+    {
+        std::uint32_t family_index;
+        std::uint32_t index_in_family;
+        std::uint32_t timestamp_valid_bits;
+        VkQueue queue = VK_NULL_HANDLE;
+        VkCommandPool command_pool = VK_NULL_HANDLE;
+        std::vector<VkCommandBuffer> command_buffers;
+    };
+
+    VkPhysicalDevice phy_device;
+    VkDevice device;
+    // Compute queues first, the transfer queue (if any) last
+    std::vector<queue_slot> queues;
+    std::size_t compute_queue_count;
+
+    coopmat_benchmark_shader::configuration configuration;
+    std::unique_ptr<pipeline_cache> cache;
+    std::unique_ptr<memory_arena> arena;
+
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    std::uint32_t subgroup_size;
+    std::uint32_t min_subgroup_size;
+    std::uint32_t max_subgroup_size;
+};
+
+#endif /* ifndef DEVICE_CONTEXT */
@@ -0,0 +1,12 @@
+#ifndef EMBEDDED_TEMPLATES
+#define EMBEDDED_TEMPLATES
+
+#include <optional>
+#include <string_view>
+
+// The *.comp.glsl.in templates as they were when coopmat was built, so the binary doesn't
+// need them next to it. nullopt if there is no template called 'name'.
+// Defined in embedded_templates.cpp, which the build generates with cmake/embed_templates.cmake
+std::optional<std::string_view> find_embedded_template(std::string_view name);
+
+#endif /* ifndef EMBEDDED_TEMPLATES */
@@ -0,0 +1,241 @@
+#include "memory_arena.hpp"
+
+#include <fmt/format.h>
+#include <vulkan/vk_enum_string_helper.h>
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+
+memory_arena::memory_arena(
+        VkDevice device,
+        const VkPhysicalDeviceMemoryProperties& memory_properties,
+        VkDeviceSize block_size)
+    : device(device),
+      memory_properties(memory_properties),
+      block_size(block_size)
+{}
+
+memory_arena::~memory_arena()
+{
+    for(auto& b : blocks)
+    {
+        release_block(b);
+    }
+}
+
+void memory_arena::release_block(block& b)
+{
+    if(b.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    if(b.mapped)
+    {
+        vkUnmapMemory(device, b.memory);
+    }
+    vkFreeMemory(device, b.memory, nullptr);
+    b = block{};
+}
+
+VkDeviceSize memory_arena::get_reserved_bytes() const
+{
+    std::lock_guard lock(mutex);
+    VkDeviceSize bytes = 0;
+    for(const auto& b : blocks)
+    {
+        bytes += b.size;
+    }
+    return bytes;
+}
+
+std::size_t memory_arena::get_block_count() const
+{
+    std::lock_guard lock(mutex);
+    return std::count_if(blocks.begin(), blocks.end(), [](const block& b)
+    {
+        return b.memory != VK_NULL_HANDLE;
+    });
+}
+
+std::size_t memory_arena::create_block(std::uint32_t memory_type, VkDeviceSize size)
+{
+    // Every buffer we make wants a device address
+    VkMemoryAllocateFlagsInfo mafi
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
+    };
+    VkMemoryAllocateInfo mai
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &mafi,
+        .allocationSize = size,
+        .memoryTypeIndex = memory_type,
+    };
+
+    block b
+    {
+        .memory = VK_NULL_HANDLE,
+        .size = size,
+        .memory_type = memory_type,
+        .mapped = nullptr,
+    };
+    auto ret = vkAllocateMemory(device, &mai, nullptr, &b.memory);
+    if(VK_SUCCESS != ret)
+    {
+        fmt::print("Failed to allocate {} bytes of memory type {}: {}\n", size, memory_type, string_VkResult(ret));
+        throw std::runtime_error("Failed to allocate device memory");
+    }
+    if(memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        void* ptr = nullptr;
+        if(VK_SUCCESS != vkMapMemory(device, b.memory, 0, VK_WHOLE_SIZE, 0, &ptr))
+        {
+            vkFreeMemory(device, b.memory, nullptr);
+            throw std::runtime_error("Failed to map host visible memory");
+        }
+        b.mapped = static_cast<std::byte*>(ptr);
+    }
+    b.free_ranges.emplace(0, size);
+    // Slots of released blocks are reused, the indices of the live ones must not change
+    auto slot = std::find_if(blocks.begin(), blocks.end(), [](const block& other)
+    {
+        return other.memory == VK_NULL_HANDLE;
+    });
+    if(slot != blocks.end())
+    {
+        *slot = std::move(b);
+        return std::distance(blocks.begin(), slot);
+    }
+    blocks.push_back(std::move(b));
+    return blocks.size() - 1;
+}
+
+bool memory_arena::take_range(block& b, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+    alignment = std::max<VkDeviceSize>(alignment, 1);
+    // First fit, the blocks hold a handful of buffers at most
+    for(auto it = b.free_ranges.begin(); it != b.free_ranges.end(); ++it)
+    {
+        auto [range_offset, range_size] = *it;
+        VkDeviceSize aligned = (range_offset + alignment - 1)/alignment*alignment;
+        if(aligned + size > range_offset + range_size)
+        {
+            continue;
+        }
+        b.free_ranges.erase(it);
+        if(aligned > range_offset)
+        {
+            b.free_ranges.emplace(range_offset, aligned - range_offset);
+        }
+        if(aligned + size < range_offset + range_size)
+        {
+            b.free_ranges.emplace(aligned + size, range_offset + range_size - aligned - size);
+        }
+        offset = aligned;
+        return true;
+    }
+    return false;
+}
+
+memory_arena::allocation memory_arena::allocate(
+        const VkMemoryRequirements& requirements,
+        VkMemoryPropertyFlags preferred,
+        VkMemoryPropertyFlags required)
+{
+    auto find_type = [&](VkMemoryPropertyFlags flags) -> std::optional<std::uint32_t>
+    {
+        for(std::uint32_t i = 0; i < memory_properties.memoryTypeCount; i++)
+        {
+            if((requirements.memoryTypeBits & (1u << i)) &&
+               (memory_properties.memoryTypes[i].propertyFlags & flags) == flags)
+            {
+                return i;
+            }
+        }
+        return std::nullopt;
+    };
+    auto memory_type = find_type(preferred);
+    if(!memory_type)
+    {
+        memory_type = find_type(required);
+    }
+    if(!memory_type)
+    {
+        throw std::runtime_error("Failed to find Vulkan memory type");
+    }
+
+    std::lock_guard lock(mutex);
+    const VkDeviceSize size = std::max<VkDeviceSize>(requirements.size, 1);
+    allocation range
+    {
+        .size = size,
+        .memory_type = *memory_type,
+    };
+    for(std::size_t i = 0; i < blocks.size(); i++)
+    {
+        if(blocks[i].memory_type == *memory_type &&
+           take_range(blocks[i], size, requirements.alignment, range.offset))
+        {
+            range.block = i;
+            range.memory = blocks[i].memory;
+            range.mapped = blocks[i].mapped ? blocks[i].mapped + range.offset : nullptr;
+            return range;
+        }
+    }
+
+    // Nothing free that fits, big buffers get a block of their own (rounded up to whole MiB),
+    // which stays around for whatever comes next
+    constexpr VkDeviceSize granularity = 1ull << 20;
+    const VkDeviceSize new_block_size = std::max(block_size, (size + granularity - 1)/granularity*granularity);
+
+    // Unused blocks that are too small go away first, so a sweep over growing sizes
+    // ends up with about the memory of its largest point instead of the sum of all of them
+    for(auto& b : blocks)
+    {
+        bool unused = (b.free_ranges.size() == 1) && (b.free_ranges.begin()->second == b.size);
+        if(b.memory != VK_NULL_HANDLE && b.memory_type == *memory_type && unused && b.size < new_block_size)
+        {
+            release_block(b);
+        }
+    }
+    range.block = create_block(*memory_type, new_block_size);
+    auto& b = blocks[range.block];
+    take_range(b, size, requirements.alignment, range.offset);
+    range.memory = b.memory;
+    range.mapped = b.mapped ? b.mapped + range.offset : nullptr;
+    return range;
+}
+
+void memory_arena::free(const allocation& range)
+{
+    if(range.memory == VK_NULL_HANDLE)
+    {
+        return;
+    }
+    std::lock_guard lock(mutex);
+    auto& free_ranges = blocks.at(range.block).free_ranges;
+    VkDeviceSize offset = range.offset;
+    VkDeviceSize size = range.size;
+
+    // Merge with the free neighbours on either side
+    auto next = free_ranges.lower_bound(offset);
+    if(next != free_ranges.end() && offset + size == next->first)
+    {
+        size += next->second;
+        next = free_ranges.erase(next);
+    }
+    if(next != free_ranges.begin())
+    {
+        auto previous = std::prev(next);
+        if(previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size += previous->second;
+            free_ranges.erase(previous);
+        }
+    }
+    free_ranges.emplace(offset, size);
+}
@@ -0,0 +1,77 @@
+#ifndef MEMORY_ARENA
+#define MEMORY_ARENA
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Hands out sub-ranges of a few big VkDeviceMemory blocks, so benchmarks don't
+// allocate/free driver memory for every run (and a sweep can't run into maxMemoryAllocationCount).
+// Freed ranges go back to their block, blocks themselves stay around for reuse. The only
+// time one is released early is when allocate() needs a new block: completely unused blocks
+// of the same memory type that are smaller than the new one are freed first. Everything else
+// is freed when the arena goes away. One per device, destroy it before the device.
+class memory_arena
+{
+public:
+    struct allocation
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        // Persistently mapped, nullptr if the memory isn't host visible
+        std::byte* mapped = nullptr;
+        std::uint32_t memory_type = 0;
+        std::size_t block = 0;
+    };
+
+    memory_arena(
+            VkDevice device,
+            const VkPhysicalDeviceMemoryProperties& memory_properties,
+            VkDeviceSize block_size = 64ull << 20);
+    memory_arena(const memory_arena&) = delete;
+    memory_arena& operator=(const memory_arena&) = delete;
+    ~memory_arena();
+
+    // Takes the first memory type allowed by 'requirements' that has all 'preferred' flags,
+    // if there is none the first one with all 'required' flags
+    allocation allocate(
+            const VkMemoryRequirements& requirements,
+            VkMemoryPropertyFlags preferred,
+            VkMemoryPropertyFlags required);
+    void free(const allocation& range);
+
+    std::size_t get_block_count() const;
+
+    // Sum of all block sizes, i.e. what the driver actually gave us
+    VkDeviceSize get_reserved_bytes() const;
+private:
+    // memory is VK_NULL_HANDLE for slots of blocks that were released
+    struct block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        std::uint32_t memory_type = 0;
+        std::byte* mapped = nullptr;
+        // offset -> size, neighbouring free ranges are always merged
+        std::map<VkDeviceSize, VkDeviceSize> free_ranges;
+    };
+
+    std::size_t create_block(std::uint32_t memory_type, VkDeviceSize size);
+    void release_block(block& b);
+    // Carves 'size' bytes at 'alignment' out of the block, returns false if it doesn't fit
+    static bool take_range(block& b, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties memory_properties;
+    VkDeviceSize block_size;
+
+    mutable std::mutex mutex;
+    std::vector<block> blocks;
+};
+
+#endif /* ifndef MEMORY_ARENA */
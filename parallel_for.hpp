@@ -0,0 +1,75 @@
+#ifndef PARALLEL_FOR
+#define PARALLEL_FOR
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+inline std::size_t default_thread_count()
+{
+    return std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+// Calls fn(worker_index, item_index) for every item in [0, count) on up to num_threads threads.
+// Items are handed out one at a time, so uneven work (e.g. big unrolled shaders) balances itself.
+// The first exception thrown by fn stops handing out items and is rethrown once all workers are done.
+template<typename Fn>
+void parallel_for(std::size_t count, Fn&& fn, std::size_t num_threads = default_thread_count())
+{
+    num_threads = std::min(num_threads, count);
+    if(num_threads <= 1)
+    {
+        for(std::size_t i = 0; i < count; i++)
+        {
+            fn(std::size_t{0}, i);
+        }
+        return;
+    }
+
+    std::atomic<std::size_t> next{0};
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    auto worker = [&](std::size_t worker_index)
+    {
+        for(std::size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                fn(worker_index, i);
+            }
+            catch(...)
+            {
+                std::lock_guard lock(error_mutex);
+                if(!error)
+                {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads-1);
+    for(std::size_t w = 1; w < num_threads; w++)
+    {
+        threads.emplace_back(worker, w);
+    }
+    worker(0);
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    if(error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+#endif /* ifndef PARALLEL_FOR */
@@ -0,0 +1,141 @@
+#include "pipeline_cache.hpp"
+#include "cache_utils.hpp"
+
+#include <fmt/format.h>
+#include <vulkan/vk_enum_string_helper.h>
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    // The data returned by vkGetPipelineCacheData starts with this header,
+    // anything that doesn't match the current device/driver is useless (or worse)
+    bool header_matches(
+            const std::vector<std::byte>& data,
+            const VkPhysicalDeviceProperties& props)
+    {
+        VkPipelineCacheHeaderVersionOne header;
+        if(data.size() < sizeof(header))
+        {
+            return false;
+        }
+        std::memcpy(&header, data.data(), sizeof(header));
+
+        return (header.headerSize >= sizeof(header)) &&
+               (header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE) &&
+               (header.vendorID == props.vendorID) &&
+               (header.deviceID == props.deviceID) &&
+               std::equal(std::begin(header.pipelineCacheUUID), std::end(header.pipelineCacheUUID),
+                          std::begin(props.pipelineCacheUUID));
+    }
+}
+
+pipeline_cache::pipeline_cache(
+        VkPhysicalDevice phy_device,
+        VkDevice device,
+        const std::filesystem::path& directory)
+    : device(device)
+{
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(phy_device, &props);
+
+    // Identical GPUs share a file, the driver (version) is checked through the header
+    path = directory / fmt::format("{:04x}_{:04x}.bin", props.vendorID, props.deviceID);
+
+    std::vector<std::byte> initial_data;
+    if(auto data = read_binary_file(path))
+    {
+        if(header_matches(*data, props))
+        {
+            initial_data = std::move(*data);
+        }
+        else
+        {
+            fmt::print("Pipeline cache {} doesn't match device/driver, starting with an empty one\n", path.string());
+        }
+    }
+
+    VkPipelineCacheCreateInfo pcci
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = initial_data.size(),
+        .pInitialData = initial_data.empty() ? nullptr : initial_data.data(),
+    };
+
+    auto result = vkCreatePipelineCache(device, &pcci, nullptr, &cache);
+    if(VK_SUCCESS != result && !initial_data.empty())
+    {
+        // Drivers are allowed to reject the data for their own reasons
+        fmt::print("Driver rejected pipeline cache {} ({}), starting with an empty one\n",
+                path.string(), string_VkResult(result));
+        pcci.initialDataSize = 0;
+        pcci.pInitialData = nullptr;
+        result = vkCreatePipelineCache(device, &pcci, nullptr, &cache);
+    }
+    if(VK_SUCCESS != result)
+    {
+        throw std::runtime_error("Failed to create pipeline cache");
+    }
+}
+
+pipeline_cache::~pipeline_cache()
+{
+    vkDestroyPipelineCache(device, cache, nullptr);
+}
+
+void pipeline_cache::save() const
+{
+    std::size_t size = 0;
+    if(VK_SUCCESS != vkGetPipelineCacheData(device, cache, &size, nullptr))
+    {
+        fmt::print("Failed to get pipeline cache size\n");
+        return;
+    }
+    std::vector<std::byte> data(size);
+    if(VK_SUCCESS != vkGetPipelineCacheData(device, cache, &size, data.data()))
+    {
+        fmt::print("Failed to get pipeline cache data\n");
+        return;
+    }
+    data.resize(size);
+
+    if(!write_binary_file_atomically(path, data))
+    {
+        fmt::print("Failed to write pipeline cache {}\n", path.string());
+    }
+}
+
+void pipeline_cache::record(bool cache_hit, double nanoseconds)
+{
+    std::lock_guard lock(statistics_mutex);
+    if(cache_hit)
+    {
+        hit_count++;
+        hit_nanoseconds += nanoseconds;
+    }
+    else
+    {
+        miss_count++;
+        miss_nanoseconds += nanoseconds;
+    }
+}
+
+void pipeline_cache::print_statistics() const
+{
+    std::lock_guard lock(statistics_mutex);
+    fmt::print("Pipeline creation ({}):\n", path.string());
+    if(hit_count > 0)
+    {
+        fmt::print("    cache hit:  {:4d} pipelines, avg. {:.3f} ms\n",
+                hit_count, hit_nanoseconds/static_cast<double>(hit_count)*1e-6);
+    }
+    if(miss_count > 0)
+    {
+        fmt::print("    cache miss: {:4d} pipelines, avg. {:.3f} ms\n",
+                miss_count, miss_nanoseconds/static_cast<double>(miss_count)*1e-6);
+    }
+}
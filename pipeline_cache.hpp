@@ -0,0 +1,46 @@
+#ifndef PIPELINE_CACHE
+#define PIPELINE_CACHE
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+
+// Per-device VkPipelineCache that is loaded from/saved to disk, so the driver
+// doesn't have to compile the same pipelines to ISA on every run
+class pipeline_cache
+{
+public:
+    pipeline_cache(
+            VkPhysicalDevice phy_device,
+            VkDevice device,
+            const std::filesystem::path& directory);
+    pipeline_cache(const pipeline_cache&) = delete;
+    pipeline_cache& operator=(const pipeline_cache&) = delete;
+    ~pipeline_cache();
+
+    auto get() const -> VkPipelineCache
+    {
+        return cache;
+    }
+
+    // Write the current contents back to disk
+    void save() const;
+
+    // Keep track of how long pipeline creation took with and without a cache hit
+    void record(bool cache_hit, double nanoseconds);
+    void print_statistics() const;
+private:
+    VkDevice device;
+    VkPipelineCache cache = VK_NULL_HANDLE;
+    std::filesystem::path path;
+
+    mutable std::mutex statistics_mutex;
+    std::uint64_t hit_count = 0;
+    std::uint64_t miss_count = 0;
+    double hit_nanoseconds = 0.0;
+    double miss_nanoseconds = 0.0;
+};
+
+#endif /* ifndef PIPELINE_CACHE */
@@ -0,0 +1,69 @@
+#include "precompiled_spirv.hpp"
+#include "cache_utils.hpp"
+
+#include <array>
+#include <atomic>
+#include <iterator>
+
+namespace
+{
+    struct precompiled_entry
+    {
+        std::uint64_t key;
+        const std::uint32_t* code;
+        std::size_t size;
+    };
+
+#ifdef COOPMAT_PRECOMPILED_SPIRV
+    // Defines precompiled_entries, generated by coopmat_precompile
+    #include "precompiled_spirv_table.inc"
+#else
+    constexpr std::array<precompiled_entry, 0> precompiled_entries{};
+#endif
+
+    std::atomic<std::uint64_t> hits{0};
+}
+
+std::uint64_t make_precompiled_spirv_key(
+        std::string_view code_template,
+        const std::vector<std::pair<std::string, std::string>>& macros)
+{
+    fnv1a hash;
+    hash.update(code_template);
+    for(const auto& [key, value] : macros)
+    {
+        hash.update(key);
+        hash.update(value);
+    }
+    return hash.digest();
+}
+
+std::optional<std::span<const std::uint32_t>> find_precompiled_spirv(
+        std::string_view code_template,
+        const std::vector<std::pair<std::string, std::string>>& macros)
+{
+    if(precompiled_entries.empty())
+    {
+        return std::nullopt;
+    }
+    auto key = make_precompiled_spirv_key(code_template, macros);
+    for(const auto& entry : precompiled_entries)
+    {
+        if(entry.key == key)
+        {
+            hits++;
+            return std::span(entry.code, entry.size);
+        }
+    }
+    return std::nullopt;
+}
+
+std::size_t get_precompiled_spirv_count()
+{
+    return precompiled_entries.size();
+}
+
+std::uint64_t get_precompiled_spirv_hits()
+{
+    return hits;
+}
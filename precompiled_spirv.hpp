@@ -0,0 +1,29 @@
+#ifndef PRECOMPILED_SPIRV
+#define PRECOMPILED_SPIRV
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// SPIR-V of the common shader variants, compiled by coopmat_precompile while building
+// with -DCOOPMAT_PRECOMPILE_SPIRV=ON (without it the table is empty).
+// Entries are keyed on the template and the macros only, a variant that was compiled
+// from a different template (--template-dir) or with other macros just isn't found
+std::uint64_t make_precompiled_spirv_key(
+        std::string_view code_template,
+        const std::vector<std::pair<std::string, std::string>>& macros);
+
+std::optional<std::span<const std::uint32_t>> find_precompiled_spirv(
+        std::string_view code_template,
+        const std::vector<std::pair<std::string, std::string>>& macros);
+
+std::size_t get_precompiled_spirv_count();
+// Lookups that found something, shaders might get compiled from multiple threads
+std::uint64_t get_precompiled_spirv_hits();
+
+#endif /* ifndef PRECOMPILED_SPIRV */
@@ -0,0 +1,241 @@
+#ifndef REFERENCE_GEMM
+#define REFERENCE_GEMM
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+#include "parallel_for.hpp"
+
+struct validation_result
+{
+    bool passed;
+    std::uint64_t checked;
+    std::uint64_t mismatches;
+    // Largest |gpu - reference| seen, and the element it happened at
+    double max_error;
+    std::uint64_t max_error_index;
+    double reference_seconds;
+};
+
+// What coopmat.comp.glsl.in does with its buffers: group g loads its own A (MxK)
+// and B (KxN) tile once, and adds A*B 'repeats' times onto each of its
+// insts_in_block C (MxN) tiles. Everything is row major and tightly packed.
+struct reference_layout
+{
+    std::size_t m;
+    std::size_t n;
+    std::size_t k;
+    std::size_t num_groups;
+    std::size_t insts_in_block;
+    // blocks_in_kernel*params.n
+    std::uint64_t repeats;
+    // Integer accumulators clamp instead of wrapping
+    bool saturating;
+};
+
+// Small values, so the products and most of the sums are exact in every type we have
+// and a mismatch really means the hardware got it wrong, not that it rounded differently.
+// Accumulators get a wider range, so the C input actually matters
+template<typename T>
+void fill_reference_input(std::span<T> values, std::uint64_t seed, bool accumulator)
+{
+    std::mt19937_64 rng(seed);
+    if constexpr(std::is_integral_v<T>)
+    {
+        std::int64_t low = std::is_signed_v<T> ? (accumulator ? -1000 : -8) : 0;
+        std::int64_t high = accumulator ? 1000 : (std::is_signed_v<T> ? 8 : 15);
+        std::uniform_int_distribution<std::int64_t> dist(low, high);
+        for(auto& v : values)
+        {
+            v = static_cast<T>(dist(rng));
+        }
+    }
+    else
+    {
+        // Multiples of 1/4, f16 holds the products and sums of these exactly up to a few hundred
+        std::int64_t range = accumulator ? 64 : 8;
+        std::uniform_int_distribution<std::int64_t> dist(-range, range);
+        for(auto& v : values)
+        {
+            v = static_cast<T>(static_cast<double>(dist(rng))*0.25);
+        }
+    }
+}
+
+// What the reference sums in for a result type, A/B/C are widened to this before the check
+template<typename d_type>
+using reference_accumulator_t = std::conditional_t<std::is_integral_v<d_type>, std::int64_t, double>;
+
+namespace reference_gemm_detail
+{
+    template<typename c_type>
+    using accumulator_t = reference_accumulator_t<c_type>;
+
+    // One coopMatMulAdd worth of accumulation onto an element of C, rounded
+    // (or wrapped/clamped) to the storage type like the hardware has to
+    template<typename c_type>
+    accumulator_t<c_type> accumulate(accumulator_t<c_type> c, accumulator_t<c_type> product, bool saturating)
+    {
+        auto sum = c + product;
+        if constexpr(std::is_integral_v<c_type>)
+        {
+            if(saturating)
+            {
+                return std::clamp<std::int64_t>(sum,
+                        std::numeric_limits<c_type>::lowest(),
+                        std::numeric_limits<c_type>::max());
+            }
+            // Conversion to the narrower type is modulo 2^n since C++20
+            return static_cast<c_type>(sum);
+        }
+        else
+        {
+            return static_cast<double>(static_cast<c_type>(sum));
+        }
+    }
+
+    template<typename c_type>
+    double epsilon()
+    {
+        if constexpr(std::is_integral_v<c_type>)
+        {
+            return 0.0;
+        }
+        else if constexpr(sizeof(c_type) == 2)
+        {
+            // numeric_limits isn't there for std::float16_t everywhere
+            return 0x1p-10;
+        }
+        else
+        {
+            return std::numeric_limits<c_type>::epsilon();
+        }
+    }
+}
+
+// Compares d_result against the host reference for every element of every tile.
+// A, B and the C input come in already widened to the accumulator of the result type,
+// the sums are rounded like d_type, which is what the kernel accumulates in.
+// The loops are written so the compiler can vectorize the innermost one (contiguous
+// row of B/C, no aliasing, no branches), tiles are spread over all cores.
+template<typename d_type>
+validation_result check_reference_gemm(
+        const reference_layout& layout,
+        std::span<const reference_accumulator_t<d_type>> a,
+        std::span<const reference_accumulator_t<d_type>> b,
+        std::span<const reference_accumulator_t<d_type>> c_initial,
+        const d_type* d_result)
+{
+    using namespace reference_gemm_detail;
+    using acc_t = accumulator_t<d_type>;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto m = layout.m, n = layout.n, k = layout.k;
+    const auto a_tile = m*k, b_tile = k*n, c_tile = m*n;
+    // Floats: the hardware may accumulate in a different order or with more precision
+    // internally, so allow a few ulps per addition relative to the magnitudes involved
+    const double eps = epsilon<d_type>();
+    const double ulps = static_cast<double>(k + layout.repeats + 1);
+
+    struct worker_state
+    {
+        std::vector<acc_t> product;
+        std::vector<double> magnitude;
+        std::uint64_t mismatches = 0;
+        double max_error = 0.0;
+        std::uint64_t max_error_index = 0;
+    };
+    std::vector<worker_state> workers(default_thread_count());
+
+    parallel_for(layout.num_groups, [&](std::size_t worker_index, std::size_t group)
+    {
+        auto& w = workers[worker_index];
+        w.product.assign(c_tile, acc_t{});
+        w.magnitude.assign(c_tile, 0.0);
+
+        const acc_t* a_g = a.data() + group*a_tile;
+        const acc_t* b_g = b.data() + group*b_tile;
+
+        // A*B is the same for every instruction of the group, so only do it once
+        for(std::size_t row = 0; row < m; row++)
+        {
+            acc_t* __restrict p_row = w.product.data() + row*n;
+            double* __restrict mag_row = w.magnitude.data() + row*n;
+            for(std::size_t kk = 0; kk < k; kk++)
+            {
+                const acc_t a_v = a_g[row*k + kk];
+                const acc_t* __restrict b_row = b_g + kk*n;
+                for(std::size_t col = 0; col < n; col++)
+                {
+                    p_row[col] += a_v*b_row[col];
+                }
+                if constexpr(!std::is_integral_v<d_type>)
+                {
+                    for(std::size_t col = 0; col < n; col++)
+                    {
+                        mag_row[col] += std::abs(a_v*b_row[col]);
+                    }
+                }
+            }
+        }
+
+        for(std::size_t inst = 0; inst < layout.insts_in_block; inst++)
+        {
+            const std::size_t base = (group*layout.insts_in_block + inst)*c_tile;
+            for(std::size_t e = 0; e < c_tile; e++)
+            {
+                acc_t c_ref = c_initial[base + e];
+                const double c_magnitude = std::abs(static_cast<double>(c_ref));
+                for(std::uint64_t r = 0; r < layout.repeats; r++)
+                {
+                    c_ref = accumulate<d_type>(c_ref, w.product[e], layout.saturating);
+                }
+
+                const double error = std::abs(static_cast<double>(d_result[base + e]) - static_cast<double>(c_ref));
+                const double tolerance = eps*ulps*(c_magnitude + static_cast<double>(layout.repeats)*w.magnitude[e]);
+                // NaN != NaN, so a NaN result never passes
+                if(!(error <= tolerance))
+                {
+                    w.mismatches++;
+                }
+                if(!(error <= w.max_error))
+                {
+                    w.max_error = error;
+                    w.max_error_index = base + e;
+                }
+            }
+        }
+    });
+
+    validation_result result
+    {
+        .passed = true,
+        .checked = static_cast<std::uint64_t>(layout.num_groups*layout.insts_in_block*c_tile),
+        .mismatches = 0,
+        .max_error = 0.0,
+        .max_error_index = 0,
+        .reference_seconds = 0.0,
+    };
+    for(const auto& w : workers)
+    {
+        result.mismatches += w.mismatches;
+        if(!(w.max_error <= result.max_error))
+        {
+            result.max_error = w.max_error;
+            result.max_error_index = w.max_error_index;
+        }
+    }
+    result.passed = (result.mismatches == 0);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.reference_seconds = elapsed.count();
+    return result;
+}
+
+#endif /* ifndef REFERENCE_GEMM */
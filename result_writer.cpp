@@ -0,0 +1,251 @@
+#include "result_writer.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <fmt/format.h>
+
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace
+{
+    // Appending rows to a file with other columns would silently shift everything
+    constexpr std::string_view csv_header =
+        "kernel,device,driver_version,M,N,K,a_type,b_type,c_type,result_type,saturating,scope,subgroup_size,workgroup_subgroups,"
+        "blocks_in_kernel,insts_in_block,num_groups,inner_iterations,outer_iterations,"
+        "ops_per_dispatch,bytes_per_dispatch,timestamp_period,min_ns,avg_ns,max_gops_per_sec,avg_gops_per_sec,"
+        "median_ns,p5_ns,p95_ns,p99_ns,stddev_ns,cv,ci_low_ns,ci_high_ns,samples,outliers,"
+        "warmup_iterations,warmup_settled,"
+        "pipeline_creation_ns,pipeline_cache_hit,validation,validation_mismatches,fraction_of_peak,timestamps";
+
+    std::string json_escape(std::string_view str)
+    {
+        std::string escaped;
+        escaped.reserve(str.size()+2);
+        escaped += '"';
+        for(char c : str)
+        {
+            switch(c)
+            {
+            case '"': escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if(static_cast<unsigned char>(c) < 0x20)
+                {
+                    escaped += fmt::format("\\u{:04x}", static_cast<unsigned>(c));
+                }
+                else
+                {
+                    escaped += c;
+                }
+            }
+        }
+        escaped += '"';
+        return escaped;
+    }
+
+    std::string csv_quote(std::string_view str)
+    {
+        if(str.find_first_of(",\"\n\r") == std::string_view::npos)
+        {
+            return std::string(str);
+        }
+        std::string quoted = "\"";
+        for(char c : str)
+        {
+            if(c == '"')
+            {
+                quoted += '"';
+            }
+            quoted += c;
+        }
+        quoted += '"';
+        return quoted;
+    }
+    // JSON has no inf/nan, degenerate runs (zero time, a single sample) produce them
+    std::string json_number(double value)
+    {
+        return std::isfinite(value) ? fmt::format("{}", value) : "null";
+    }
+
+    // Only the scopes the benchmarks run with
+    std::string_view scope_to_str(VkScopeKHR scope)
+    {
+        switch(scope)
+        {
+        case VK_SCOPE_SUBGROUP_KHR: return "subgroup";
+        case VK_SCOPE_WORKGROUP_KHR: return "workgroup";
+        default: return "other";
+        }
+    }
+}
+
+result_writer::result_writer(const std::filesystem::path& path, result_format format)
+    : format(format)
+{
+    // Only write the CSV header into fresh files, so multiple runs can go into the same file,
+    // as long as it has the same columns
+    std::error_code ec;
+    header_written = std::filesystem::exists(path, ec) && (std::filesystem::file_size(path, ec) > 0);
+    if(header_written && format == result_format::csv)
+    {
+        std::ifstream existing(path);
+        std::string existing_header;
+        std::getline(existing, existing_header);
+        if(!existing_header.empty() && existing_header.back() == '\r')
+        {
+            existing_header.pop_back();
+        }
+        if(existing_header != csv_header)
+        {
+            throw std::runtime_error(fmt::format(
+                        "{} has different columns than this version writes, use a new file", path.string()));
+        }
+    }
+
+    file.open(path, std::ios::app);
+    if(!file)
+    {
+        throw std::runtime_error("Failed to open result file for writing");
+    }
+}
+
+result_format result_writer::format_from_path(const std::filesystem::path& path)
+{
+    return (path.extension() == ".csv") ? result_format::csv : result_format::jsonl;
+}
+
+bool result_writer::parse_format(std::string_view name, result_format& format)
+{
+    if(name == "jsonl" || name == "json")
+    {
+        format = result_format::jsonl;
+        return true;
+    }
+    if(name == "csv")
+    {
+        format = result_format::csv;
+        return true;
+    }
+    return false;
+}
+
+void result_writer::write(const benchmark_record& record)
+{
+    std::lock_guard lock(file_mutex);
+    if(format == result_format::csv)
+    {
+        write_csv(record);
+    }
+    else
+    {
+        write_jsonl(record);
+    }
+    // Flush every record, a crashing driver shouldn't take the previous results with it
+    file.flush();
+}
+
+void result_writer::write_jsonl(const benchmark_record& record)
+{
+    const auto& cm = record.cmprops;
+    const auto& r = record.result;
+    const auto& s = r.statistics;
+    const auto& v = record.validation;
+
+    std::string timestamps;
+    for(std::size_t i = 0; i < r.timestamps.size(); i++)
+    {
+        timestamps += fmt::format("{}{}", (i == 0) ? "" : ",", r.timestamps[i]);
+    }
+
+    file << fmt::format(
+            "{{\"kernel\":{},\"device\":{},\"driver_version\":{},"
+            "\"M\":{},\"N\":{},\"K\":{},"
+            "\"a_type\":{},\"b_type\":{},\"c_type\":{},\"result_type\":{},\"saturating\":{},"
+            "\"scope\":{},\"subgroup_size\":{},\"workgroup_subgroups\":{},"
+            "\"blocks_in_kernel\":{},\"insts_in_block\":{},\"num_groups\":{},"
+            "\"inner_iterations\":{},\"outer_iterations\":{},"
+            "\"ops_per_dispatch\":{},\"bytes_per_dispatch\":{},\"timestamp_period\":{},"
+            "\"min_ns\":{},\"avg_ns\":{},\"max_gops_per_sec\":{},\"avg_gops_per_sec\":{},"
+            "\"median_ns\":{},\"p5_ns\":{},\"p95_ns\":{},\"p99_ns\":{},"
+            "\"stddev_ns\":{},\"cv\":{},\"ci_low_ns\":{},\"ci_high_ns\":{},"
+            "\"samples\":{},\"outliers\":{},"
+            "\"warmup_iterations\":{},\"warmup_settled\":{},"
+            "\"pipeline_creation_ns\":{},\"pipeline_cache_hit\":{},"
+            "\"validation\":{},\"validation_mismatches\":{},\"fraction_of_peak\":{},"
+            "\"timestamps\":[{}]}}\n",
+            json_escape(record.kernel),
+            json_escape(record.device_name), json_escape(record.driver_version),
+            cm.MSize, cm.NSize, cm.KSize,
+            json_escape(component_type_to_str(cm.AType)),
+            json_escape(component_type_to_str(cm.BType)),
+            json_escape(component_type_to_str(cm.CType)),
+            json_escape(component_type_to_str(cm.ResultType)),
+            static_cast<bool>(cm.saturatingAccumulation),
+            json_escape(scope_to_str(cm.scope)),
+            record.subgroup_size, record.workgroup_subgroups,
+            record.tuning.blocks_in_kernel, record.tuning.insts_in_block, record.tuning.num_groups,
+            record.inner_iterations, record.outer_iterations,
+            r.ops, r.bytes, json_number(r.timestamp_period),
+            json_number(r.min_nanoseconds), json_number(r.avg_nanoseconds),
+            json_number(r.max_gops_per_sec), json_number(r.avg_gops_per_sec),
+            json_number(s.median), json_number(s.p5), json_number(s.p95), json_number(s.p99),
+            json_number(s.stddev), json_number(s.cv), json_number(s.ci_low), json_number(s.ci_high),
+            s.count, s.outliers,
+            r.warmup_iterations, r.warmup_settled,
+            json_number(r.pipeline_creation_nanoseconds), r.pipeline_cache_hit,
+            v ? json_escape(v->passed ? "pass" : "fail") : "null",
+            v ? fmt::format("{}", v->mismatches) : "null",
+            record.fraction_of_peak ? json_number(*record.fraction_of_peak) : "null",
+            timestamps);
+}
+
+void result_writer::write_csv(const benchmark_record& record)
+{
+    if(!header_written)
+    {
+        file << csv_header << '\n';
+        header_written = true;
+    }
+
+    const auto& cm = record.cmprops;
+    const auto& r = record.result;
+    const auto& s = r.statistics;
+    const auto& v = record.validation;
+
+    std::string timestamps;
+    for(std::size_t i = 0; i < r.timestamps.size(); i++)
+    {
+        timestamps += fmt::format("{}{}", (i == 0) ? "" : ";", r.timestamps[i]);
+    }
+
+    file << fmt::format("{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{},{}\n",
+            csv_quote(record.kernel),
+            csv_quote(record.device_name), csv_quote(record.driver_version),
+            cm.MSize, cm.NSize, cm.KSize,
+            component_type_to_str(cm.AType),
+            component_type_to_str(cm.BType),
+            component_type_to_str(cm.CType),
+            component_type_to_str(cm.ResultType),
+            cm.saturatingAccumulation ? 1 : 0,
+            scope_to_str(cm.scope),
+            record.subgroup_size, record.workgroup_subgroups,
+            record.tuning.blocks_in_kernel, record.tuning.insts_in_block, record.tuning.num_groups,
+            record.inner_iterations, record.outer_iterations,
+            r.ops, r.bytes, r.timestamp_period,
+            r.min_nanoseconds, r.avg_nanoseconds, r.max_gops_per_sec, r.avg_gops_per_sec,
+            s.median, s.p5, s.p95, s.p99,
+            s.stddev, s.cv, s.ci_low, s.ci_high,
+            s.count, s.outliers,
+            r.warmup_iterations, r.warmup_settled ? 1 : 0,
+            r.pipeline_creation_nanoseconds, r.pipeline_cache_hit ? 1 : 0,
+            v ? (v->passed ? "pass" : "fail") : "",
+            v ? fmt::format("{}", v->mismatches) : "",
+            record.fraction_of_peak ? fmt::format("{}", *record.fraction_of_peak) : "",
+            timestamps);
+}
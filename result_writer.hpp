@@ -0,0 +1,68 @@
+#ifndef RESULT_WRITER
+#define RESULT_WRITER
+
+#include "coopmat_benchmark.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Everything we know about one benchmark run, so it can be fed into something
+// that isn't a human reading stdout
+struct benchmark_record
+{
+    // "mma" for the coopMatMulAdd throughput kernel, others describe themselves
+    std::string kernel;
+    std::string device_name;
+    std::string driver_version;
+    VkCooperativeMatrixPropertiesKHR cmprops;
+    std::uint32_t subgroup_size;
+    // Subgroups per workgroup of the kernel
+    std::uint32_t workgroup_subgroups = 1;
+    tuning_parameters tuning;
+    std::uint32_t inner_iterations;
+    std::uint32_t outer_iterations;
+    benchmark_result result;
+    // Only there when the run was checked against the host reference
+    std::optional<validation_result> validation;
+    // Median throughput over the one of the mma job it's compared against (GEMMs), or over the
+    // single queue median of its own job (the multi-queue aggregate)
+    std::optional<double> fraction_of_peak = std::nullopt;
+};
+
+enum class result_format
+{
+    jsonl,
+    csv,
+};
+
+// Appends one record per line, either as JSON Lines or CSV.
+// For CSV the raw timestamps are joined with ';' into a single column.
+// write() can be called from multiple threads
+class result_writer
+{
+public:
+    result_writer(const std::filesystem::path& path, result_format format);
+
+    // .csv -> csv, everything else -> jsonl
+    static result_format format_from_path(const std::filesystem::path& path);
+    static bool parse_format(std::string_view name, result_format& format);
+
+    void write(const benchmark_record& record);
+private:
+    void write_jsonl(const benchmark_record& record);
+    void write_csv(const benchmark_record& record);
+
+    std::mutex file_mutex;
+    std::ofstream file;
+    result_format format;
+    bool header_written = false;
+};
+
+#endif /* ifndef RESULT_WRITER */
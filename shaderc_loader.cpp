@@ -0,0 +1,163 @@
+#include "shaderc_loader.hpp"
+
+#include <fmt/format.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include <array>
+#include <cstdlib>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+#ifdef _WIN32
+    using library_handle = HMODULE;
+    constexpr std::array library_names{"shaderc_shared.dll"};
+
+    library_handle open_library(const char* name)
+    {
+        return LoadLibraryA(name);
+    }
+    void* find_symbol(library_handle library, const char* name)
+    {
+        return reinterpret_cast<void*>(GetProcAddress(library, name));
+    }
+    std::string library_path(library_handle library, void*)
+    {
+        std::array<char, 4096> path{};
+        auto length = GetModuleFileNameA(library, path.data(), static_cast<DWORD>(path.size()));
+        return std::string(path.data(), length);
+    }
+#else
+    using library_handle = void*;
+#ifdef __APPLE__
+    constexpr std::array library_names{"libshaderc_shared.1.dylib", "libshaderc_shared.dylib"};
+#else
+    constexpr std::array library_names{"libshaderc_shared.so.1", "libshaderc_shared.so"};
+#endif
+
+    library_handle open_library(const char* name)
+    {
+        return dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    }
+    void* find_symbol(library_handle library, const char* name)
+    {
+        return dlsym(library, name);
+    }
+    std::string library_path(library_handle, void* symbol)
+    {
+        Dl_info info{};
+        if(dladdr(symbol, &info) && info.dli_fname)
+        {
+            return info.dli_fname;
+        }
+        return {};
+    }
+#endif
+
+    // Follows symlinks, libshaderc_shared.so.1 stays the same name across upgrades
+    std::string file_identity(const std::string& path)
+    {
+        std::error_code ec;
+        auto canonical = std::filesystem::canonical(path, ec);
+        if(ec)
+        {
+            return path;
+        }
+        auto size = std::filesystem::file_size(canonical, ec);
+        auto modified = std::filesystem::last_write_time(canonical, ec);
+        return fmt::format("{}|{}|{}", canonical.string(), size, modified.time_since_epoch().count());
+    }
+
+    shaderc_functions load_shaderc()
+    {
+        std::vector<std::string> candidates;
+        if(const char* path = std::getenv("COOPMAT_SHADERC_LIBRARY"); path && *path)
+        {
+            candidates.emplace_back(path);
+        }
+        else
+        {
+            candidates.assign(library_names.begin(), library_names.end());
+        }
+
+        library_handle library = nullptr;
+        for(const auto& name : candidates)
+        {
+            if((library = open_library(name.c_str())))
+            {
+                break;
+            }
+        }
+        if(!library)
+        {
+            throw std::runtime_error(fmt::format(
+                        "Couldn't load {} (needed for shader variants that aren't precompiled)", candidates.front()));
+        }
+
+        // Never closed, the functions are used until the process ends
+        auto load = [library](auto& function, const char* name)
+        {
+            auto symbol = find_symbol(library, name);
+            if(!symbol)
+            {
+                throw std::runtime_error(fmt::format("libshaderc has no {}", name));
+            }
+            function = reinterpret_cast<std::remove_reference_t<decltype(function)>>(symbol);
+        };
+
+        shaderc_functions functions{};
+        load(functions.compiler_initialize, "shaderc_compiler_initialize");
+        load(functions.compiler_release, "shaderc_compiler_release");
+        load(functions.compile_options_initialize, "shaderc_compile_options_initialize");
+        load(functions.compile_options_release, "shaderc_compile_options_release");
+        load(functions.compile_options_add_macro_definition, "shaderc_compile_options_add_macro_definition");
+        load(functions.compile_options_set_optimization_level, "shaderc_compile_options_set_optimization_level");
+        load(functions.compile_options_set_target_env, "shaderc_compile_options_set_target_env");
+        load(functions.compile_into_spv, "shaderc_compile_into_spv");
+        load(functions.result_get_compilation_status, "shaderc_result_get_compilation_status");
+        load(functions.result_get_error_message, "shaderc_result_get_error_message");
+        load(functions.result_get_bytes, "shaderc_result_get_bytes");
+        load(functions.result_get_length, "shaderc_result_get_length");
+        load(functions.result_release, "shaderc_result_release");
+        load(functions.get_spv_version, "shaderc_get_spv_version");
+
+        functions.identity = file_identity(
+                library_path(library, reinterpret_cast<void*>(functions.compiler_initialize)));
+        return functions;
+    }
+}
+
+const shaderc_functions& get_shaderc()
+{
+    static std::once_flag once;
+    static std::optional<shaderc_functions> functions;
+    static std::string error;
+    std::call_once(once, []()
+    {
+        try
+        {
+            functions = load_shaderc();
+        }
+        catch(const std::runtime_error& e)
+        {
+            error = e.what();
+        }
+    });
+    if(!functions)
+    {
+        throw std::runtime_error(error);
+    }
+    return *functions;
+}
@@ -0,0 +1,65 @@
+#ifndef SHADERC_LOADER
+#define SHADERC_LOADER
+
+#include <shaderc/shaderc.h>
+
+#include <string>
+
+// libshaderc is only opened the first time something actually has to be compiled,
+// so a build with the precompiled variants still starts (and runs those) on machines
+// without it. Only the functions we use, with the signatures from shaderc.h
+struct shaderc_functions
+{
+    decltype(&::shaderc_compiler_initialize) compiler_initialize;
+    decltype(&::shaderc_compiler_release) compiler_release;
+    decltype(&::shaderc_compile_options_initialize) compile_options_initialize;
+    decltype(&::shaderc_compile_options_release) compile_options_release;
+    decltype(&::shaderc_compile_options_add_macro_definition) compile_options_add_macro_definition;
+    decltype(&::shaderc_compile_options_set_optimization_level) compile_options_set_optimization_level;
+    decltype(&::shaderc_compile_options_set_target_env) compile_options_set_target_env;
+    decltype(&::shaderc_compile_into_spv) compile_into_spv;
+    decltype(&::shaderc_result_get_compilation_status) result_get_compilation_status;
+    decltype(&::shaderc_result_get_error_message) result_get_error_message;
+    decltype(&::shaderc_result_get_bytes) result_get_bytes;
+    decltype(&::shaderc_result_get_length) result_get_length;
+    decltype(&::shaderc_result_release) result_release;
+    decltype(&::shaderc_get_spv_version) get_spv_version;
+
+    // Path, size and modification time of the library that was loaded. shaderc doesn't
+    // expose its (or glslang's) version, so this is what tells two compilers apart
+    std::string identity;
+};
+
+// Loads libshaderc on the first call (thread safe), $COOPMAT_SHADERC_LIBRARY overrides where from.
+// Throws std::runtime_error if it can't be loaded, every later call throws the same
+const shaderc_functions& get_shaderc();
+
+// One per thread, shaderc compilers shouldn't be shared between threads.
+// The compiler (and the library) only gets created by the first get()
+class lazy_shaderc_compiler
+{
+public:
+    lazy_shaderc_compiler() = default;
+    lazy_shaderc_compiler(const lazy_shaderc_compiler&) = delete;
+    lazy_shaderc_compiler& operator=(const lazy_shaderc_compiler&) = delete;
+    ~lazy_shaderc_compiler()
+    {
+        if(compiler)
+        {
+            get_shaderc().compiler_release(compiler);
+        }
+    }
+
+    shaderc_compiler_t get()
+    {
+        if(!compiler)
+        {
+            compiler = get_shaderc().compiler_initialize();
+        }
+        return compiler;
+    }
+private:
+    shaderc_compiler_t compiler = nullptr;
+};
+
+#endif /* ifndef SHADERC_LOADER */
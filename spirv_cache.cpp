@@ -0,0 +1,85 @@
+#include "spirv_cache.hpp"
+#include "cache_utils.hpp"
+#include "shaderc_loader.hpp"
+
+#include <fmt/format.h>
+
+#include <cstring>
+#include <span>
+
+namespace
+{
+    constexpr std::uint32_t spirv_magic = 0x07230203;
+    // Bump this if the way keys are built changes
+    constexpr std::uint32_t cache_format_version = 2;
+}
+
+std::uint64_t spirv_cache::make_key(
+        std::string_view code_template,
+        const std::vector<std::pair<std::string, std::string>>& macros,
+        std::uint32_t target_env,
+        std::uint32_t target_env_version,
+        std::uint32_t optimization_level)
+{
+    // shaderc doesn't expose its own version, so the library file it was loaded from stands in
+    // for it (an upgrade changes its size/mtime), plus the SPIR-V version/revision it produces
+    const auto& shaderc = get_shaderc();
+    unsigned int spv_version = 0;
+    unsigned int spv_revision = 0;
+    shaderc.get_spv_version(&spv_version, &spv_revision);
+
+    fnv1a hash;
+    hash.update_value(cache_format_version);
+    hash.update(code_template);
+    for(const auto& [key, value] : macros)
+    {
+        hash.update(key);
+        hash.update(value);
+    }
+    hash.update_value(static_cast<std::uint32_t>(spv_version));
+    hash.update_value(static_cast<std::uint32_t>(spv_revision));
+    hash.update(shaderc.identity);
+    hash.update_value(target_env);
+    hash.update_value(target_env_version);
+    hash.update_value(optimization_level);
+
+    return hash.digest();
+}
+
+std::filesystem::path spirv_cache::entry_path(std::uint64_t key) const
+{
+    return directory / fmt::format("{:016x}.spv", key);
+}
+
+std::optional<std::vector<std::uint32_t>> spirv_cache::load(std::uint64_t key) const
+{
+    auto data = read_binary_file(entry_path(key));
+
+    if(!data || data->empty() || (data->size() % sizeof(std::uint32_t)) != 0)
+    {
+        misses++;
+        return std::nullopt;
+    }
+
+    std::vector<std::uint32_t> spirv(data->size()/sizeof(std::uint32_t));
+    std::memcpy(spirv.data(), data->data(), data->size());
+
+    if(spirv[0] != spirv_magic)
+    {
+        fmt::print("Ignoring corrupted SPIR-V cache entry {}\n", entry_path(key).string());
+        misses++;
+        return std::nullopt;
+    }
+
+    hits++;
+    return spirv;
+}
+
+void spirv_cache::store(std::uint64_t key, const std::vector<std::uint32_t>& spirv) const
+{
+    if(!write_binary_file_atomically(entry_path(key), std::as_bytes(std::span(spirv))))
+    {
+        // Not fatal, we'll just have to compile again next time
+        fmt::print("Failed to write SPIR-V cache entry {}\n", entry_path(key).string());
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SPIRV_CACHE
+#define SPIRV_CACHE
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Content addressed on-disk cache for the GLSL->SPIR-V step.
+// Entries are keyed on everything that goes into shaderc_compile_into_spv
+// (template, macros, the libshaderc file and target env), so they never need invalidation
+class spirv_cache
+{
+public:
+    explicit spirv_cache(std::filesystem::path directory)
+        : directory(std::move(directory))
+    {}
+
+    static std::uint64_t make_key(
+            std::string_view code_template,
+            const std::vector<std::pair<std::string, std::string>>& macros,
+            std::uint32_t target_env,
+            std::uint32_t target_env_version,
+            std::uint32_t optimization_level);
+
+    std::optional<std::vector<std::uint32_t>> load(std::uint64_t key) const;
+    void store(std::uint64_t key, const std::vector<std::uint32_t>& spirv) const;
+
+    auto get_hits() const -> std::uint64_t
+    {
+        return hits;
+    }
+    auto get_misses() const -> std::uint64_t
+    {
+        return misses;
+    }
+    auto get_directory() const -> const std::filesystem::path&
+    {
+        return directory;
+    }
+private:
+    std::filesystem::path entry_path(std::uint64_t key) const;
+
+    std::filesystem::path directory;
+
+    // Shaders might get compiled from multiple threads
+    mutable std::atomic<std::uint64_t> hits{0};
+    mutable std::atomic<std::uint64_t> misses{0};
+};
+
+#endif /* ifndef SPIRV_CACHE */
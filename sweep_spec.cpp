@@ -0,0 +1,421 @@
+#include "sweep_spec.hpp"
+#include "vk_component_type_to_str.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+    constexpr std::array<std::pair<sweep_mode, std::string_view>, 7> mode_names
+    {{
+        {sweep_mode::validate, "validate"},
+        {sweep_mode::multi_queue, "multi-queue"},
+        {sweep_mode::latency, "latency"},
+        {sweep_mode::scaling, "scaling"},
+        {sweep_mode::phases, "phases"},
+        {sweep_mode::bandwidth, "bandwidth"},
+        {sweep_mode::transfer, "transfer"},
+    }};
+
+    auto trim(std::string_view str) -> std::string_view
+    {
+        while(!str.empty() && std::isspace(static_cast<unsigned char>(str.front())))
+        {
+            str.remove_prefix(1);
+        }
+        while(!str.empty() && std::isspace(static_cast<unsigned char>(str.back())))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+    auto split(std::string_view list, char separator) -> std::vector<std::string_view>
+    {
+        std::vector<std::string_view> parts;
+        while(!list.empty())
+        {
+            auto pos = list.find(separator);
+            auto part = trim(list.substr(0, pos));
+            if(!part.empty())
+            {
+                parts.push_back(part);
+            }
+            if(pos == std::string_view::npos)
+            {
+                break;
+            }
+            list.remove_prefix(pos + 1);
+        }
+        return parts;
+    }
+
+    // Whole string or nothing, std::stoul happily ignores trailing garbage
+    std::uint64_t parse_uint(std::string_view str)
+    {
+        str = trim(str);
+        std::uint64_t value = 0;
+        auto [end, error] = std::from_chars(str.data(), str.data() + str.size(), value);
+        if(error != std::errc{} || end != str.data() + str.size())
+        {
+            throw std::runtime_error(fmt::format("'{}' is not a number", str));
+        }
+        return value;
+    }
+
+    // Bounds are 32 bit, so value*by can't overflow the 64 bit loop variable
+    std::vector<std::uint32_t> expand_range(std::uint32_t from, std::uint32_t to, char op, std::uint32_t by)
+    {
+        if((op == '*' && by < 2) || (op == '+' && by < 1) || (op == '*' && from == 0))
+        {
+            throw std::runtime_error(fmt::format("Range {}..{}{}{} never ends", from, to, op, by));
+        }
+        std::vector<std::uint32_t> values;
+        for(std::uint64_t value = from; value <= to; value = (op == '*') ? value*by : value + by)
+        {
+            values.push_back(static_cast<std::uint32_t>(value));
+        }
+        return values;
+    }
+
+    void sort_unique(std::vector<std::uint32_t>& values)
+    {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+    }
+
+    using ptree = boost::property_tree::ptree;
+
+    // Arrays are children with empty keys in a ptree, plain values have no children at all
+    bool is_array(const ptree& node)
+    {
+        return !node.empty() && std::all_of(node.begin(), node.end(), [](const auto& child)
+        {
+            return child.first.empty();
+        });
+    }
+
+    // Strings of a value or array, each one split at commas if 'split_commas'
+    std::vector<std::string> read_strings(const ptree& node, bool split_commas)
+    {
+        std::vector<std::string> values;
+        auto add = [&](const std::string& value)
+        {
+            if(!split_commas)
+            {
+                values.push_back(value);
+                return;
+            }
+            for(auto part : split(value, ','))
+            {
+                values.emplace_back(part);
+            }
+        };
+        if(node.empty())
+        {
+            add(node.data());
+        }
+        else if(is_array(node))
+        {
+            for(const auto& [_, child] : node)
+            {
+                add(child.data());
+            }
+        }
+        else
+        {
+            throw std::runtime_error("expected a value or an array");
+        }
+        return values;
+    }
+
+    std::vector<std::uint32_t> read_uint_list(const ptree& node)
+    {
+        if(!node.empty() && !is_array(node))
+        {
+            auto from = node.get_optional<std::string>("from");
+            auto to = node.get_optional<std::string>("to");
+            auto factor = node.get_optional<std::string>("factor");
+            auto step = node.get_optional<std::string>("step");
+            if(!from || !to || (factor.has_value() == step.has_value()) || node.size() != 3)
+            {
+                throw std::runtime_error("ranges need \"from\", \"to\" and either \"factor\" or \"step\"");
+            }
+            auto values = expand_range(parse_uint32(*from), parse_uint32(*to),
+                    factor ? '*' : '+', parse_uint32(factor ? *factor : *step));
+            sort_unique(values);
+            return values;
+        }
+        std::vector<std::uint32_t> values;
+        for(const auto& part : read_strings(node, false))
+        {
+            auto part_values = parse_uint_list(part);
+            values.insert(values.end(), part_values.begin(), part_values.end());
+        }
+        sort_unique(values);
+        return values;
+    }
+
+    template<typename T>
+    std::vector<T> read_parsed(const ptree& node, std::vector<T> (*parse)(std::string_view))
+    {
+        std::vector<T> values;
+        for(const auto& part : read_strings(node, false))
+        {
+            auto part_values = parse(part);
+            values.insert(values.end(), part_values.begin(), part_values.end());
+        }
+        return values;
+    }
+}
+
+std::string_view sweep_mode_to_str(sweep_mode mode)
+{
+    for(auto [m, name] : mode_names)
+    {
+        if(m == mode)
+        {
+            return name;
+        }
+    }
+    return "unknown";
+}
+
+std::optional<sweep_mode> parse_sweep_mode(std::string_view name)
+{
+    for(auto [mode, mode_name] : mode_names)
+    {
+        if(mode_name == name)
+        {
+            return mode;
+        }
+    }
+    return std::nullopt;
+}
+
+std::uint32_t parse_uint32(std::string_view str)
+{
+    auto value = parse_uint(str);
+    if(value > std::numeric_limits<std::uint32_t>::max())
+    {
+        throw std::runtime_error(fmt::format("{} is out of range (at most {})",
+                    value, std::numeric_limits<std::uint32_t>::max()));
+    }
+    return static_cast<std::uint32_t>(value);
+}
+
+std::vector<std::uint32_t> parse_uint_list(std::string_view list)
+{
+    std::vector<std::uint32_t> values;
+    for(auto part : split(list, ','))
+    {
+        auto dots = part.find("..");
+        if(dots == std::string_view::npos)
+        {
+            values.push_back(parse_uint32(part));
+            continue;
+        }
+        auto rest = part.substr(dots + 2);
+        auto op_pos = rest.find_first_of("*+");
+        if(op_pos == std::string_view::npos)
+        {
+            throw std::runtime_error(fmt::format("Range '{}' needs *factor or +step", part));
+        }
+        auto range = expand_range(parse_uint32(part.substr(0, dots)), parse_uint32(rest.substr(0, op_pos)),
+                rest[op_pos], parse_uint32(rest.substr(op_pos + 1)));
+        values.insert(values.end(), range.begin(), range.end());
+    }
+    sort_unique(values);
+    return values;
+}
+
+std::vector<std::uint64_t> parse_byte_sizes(std::string_view list)
+{
+    std::vector<std::uint64_t> sizes;
+    for(auto size_str : split(list, ','))
+    {
+        std::uint64_t shift = 0;
+        switch(std::toupper(static_cast<unsigned char>(size_str.back())))
+        {
+            case 'G': shift += 10; [[fallthrough]];
+            case 'M': shift += 10; [[fallthrough]];
+            case 'K': shift += 10; size_str.remove_suffix(1); break;
+            default: break;
+        }
+        auto size = parse_uint(size_str);
+        if(size > (std::numeric_limits<std::uint64_t>::max() >> shift))
+        {
+            throw std::runtime_error(fmt::format("'{}' is out of range", size_str));
+        }
+        sizes.push_back(size << shift);
+    }
+    return sizes;
+}
+
+std::vector<tile_shape> parse_shapes(std::string_view list)
+{
+    std::vector<tile_shape> shapes;
+    for(auto shape_str : split(list, ','))
+    {
+        auto parts = split(shape_str, 'x');
+        if(parts.size() != 3)
+        {
+            throw std::runtime_error(fmt::format("'{}' is not MxNxK", shape_str));
+        }
+        shapes.push_back(tile_shape{
+                .m = parse_uint32(parts[0]),
+                .n = parse_uint32(parts[1]),
+                .k = parse_uint32(parts[2])});
+    }
+    return shapes;
+}
+
+bool sweep_spec::matches_device(std::size_t index, std::string_view name) const
+{
+    if(devices.empty())
+    {
+        return true;
+    }
+    return std::any_of(devices.begin(), devices.end(), [&](const std::string& filter)
+    {
+        return (filter == std::to_string(index)) || (name.find(filter) != std::string_view::npos);
+    });
+}
+
+bool sweep_spec::matches_configuration(const VkCooperativeMatrixPropertiesKHR& cmprops) const
+{
+    bool shape_ok = shapes.empty() || std::any_of(shapes.begin(), shapes.end(), [&](const tile_shape& shape)
+    {
+        return shape.m == cmprops.MSize && shape.n == cmprops.NSize && shape.k == cmprops.KSize;
+    });
+    bool types_ok = types.empty() || std::any_of(types.begin(), types.end(), [&](const std::string& filter)
+    {
+        const std::array<VkComponentTypeKHR, 4> actual{cmprops.AType, cmprops.BType, cmprops.CType, cmprops.ResultType};
+        auto wanted = split(filter, '/');
+        if(wanted.size() > actual.size())
+        {
+            return false;
+        }
+        for(std::size_t i = 0; i < wanted.size(); i++)
+        {
+            if(wanted[i] != "*" && wanted[i] != component_type_to_str(actual[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    });
+    return shape_ok && types_ok;
+}
+
+void load_sweep_spec(const std::filesystem::path& path, sweep_spec& spec)
+{
+    ptree root;
+    try
+    {
+        boost::property_tree::read_json(path.string(), root);
+    }
+    catch(const boost::property_tree::json_parser_error& e)
+    {
+        throw std::runtime_error(fmt::format("Failed to read sweep file: {}", e.what()));
+    }
+
+    for(const auto& [key, node] : root)
+    {
+        try
+        {
+            if(key == "blocks_in_kernel")
+            {
+                spec.blocks_in_kernel = read_uint_list(node);
+            }
+            else if(key == "insts_in_block")
+            {
+                spec.insts_in_block = read_uint_list(node);
+            }
+            else if(key == "num_groups")
+            {
+                spec.num_groups = read_uint_list(node);
+            }
+            else if(key == "inner_iterations")
+            {
+                spec.inner_iterations = read_uint_list(node);
+            }
+            else if(key == "workgroup_subgroups")
+            {
+                spec.workgroup_subgroups = read_uint_list(node);
+            }
+            else if(key == "repetitions")
+            {
+                spec.repetitions = parse_uint32(node.data());
+            }
+            else if(key == "devices")
+            {
+                spec.devices = read_strings(node, false);
+            }
+            else if(key == "shapes")
+            {
+                spec.shapes = read_parsed(node, parse_shapes);
+            }
+            else if(key == "types")
+            {
+                spec.types = read_strings(node, true);
+            }
+            else if(key == "modes")
+            {
+                spec.modes.clear();
+                for(const auto& name : read_strings(node, true))
+                {
+                    auto mode = parse_sweep_mode(name);
+                    if(!mode)
+                    {
+                        throw std::runtime_error(fmt::format("unknown mode '{}'", name));
+                    }
+                    spec.modes.insert(*mode);
+                }
+            }
+            else if(key == "gemm")
+            {
+                spec.gemm_sizes.clear();
+                for(auto shape : read_parsed(node, parse_shapes))
+                {
+                    spec.gemm_sizes.push_back(gemm_size{shape.m, shape.n, shape.k});
+                }
+            }
+            else if(key == "bandwidth_sizes")
+            {
+                spec.bandwidth_sizes = read_parsed(node, parse_byte_sizes);
+            }
+            else if(key == "transfer_sizes")
+            {
+                spec.transfer_sizes = read_parsed(node, parse_byte_sizes);
+            }
+            else if(key == "template_directory")
+            {
+                // Relative to the sweep file, so a sweep file can sit next to its templates
+                spec.template_directory = path.parent_path() / node.data();
+            }
+            else
+            {
+                throw std::runtime_error("unknown key");
+            }
+        }
+        catch(const std::runtime_error& e)
+        {
+            throw std::runtime_error(fmt::format("{}: \"{}\": {}", path.string(), key, e.what()));
+        }
+    }
+
+    if(spec.inner_iterations.empty() || spec.workgroup_subgroups.empty() || spec.repetitions == 0)
+    {
+        throw std::runtime_error(fmt::format("{}: inner_iterations, workgroup_subgroups and repetitions can't be empty",
+                    path.string()));
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SWEEP_SPEC
+#define SWEEP_SPEC
+
+#include "coopmat_gemm_benchmark.hpp"
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Extra benchmarks that run next to the plain mma ones
+enum class sweep_mode
+{
+    validate,
+    multi_queue,
+    latency,
+    scaling,
+    phases,
+    bandwidth,
+    transfer,
+};
+
+std::string_view sweep_mode_to_str(sweep_mode mode);
+std::optional<sweep_mode> parse_sweep_mode(std::string_view name);
+
+struct tile_shape
+{
+    std::uint32_t m;
+    std::uint32_t n;
+    std::uint32_t k;
+};
+
+// Everything that decides which jobs run and how, set from the command line and/or a sweep file.
+// The job list is the cross product of the tuning lists over every configuration that passes the filters
+struct sweep_spec
+{
+    // Empty means the tuned (or default) value of each configuration
+    std::vector<std::uint32_t> blocks_in_kernel;
+    std::vector<std::uint32_t> insts_in_block;
+    std::vector<std::uint32_t> num_groups;
+    // Loop count inside the kernel
+    std::vector<std::uint32_t> inner_iterations{256};
+    // Subgroups per workgroup of the mma kernel, values the device can't do are dropped
+    std::vector<std::uint32_t> workgroup_subgroups{1};
+    // Dispatches per measurement batch
+    std::uint32_t repetitions = 10;
+
+    // Empty filters let everything through. Devices match by index or by a part of their name,
+    // types are "A/B/C/D" with the names from component_type_to_str, '*' or leaving
+    // the trailing ones out matches any type
+    std::vector<std::string> devices;
+    std::vector<tile_shape> shapes;
+    std::vector<std::string> types;
+
+    std::set<sweep_mode> modes;
+    std::vector<gemm_size> gemm_sizes;
+    std::vector<std::uint64_t> bandwidth_sizes{16ull << 10, 256ull << 10, 4ull << 20, 64ull << 20, 512ull << 20};
+    std::vector<std::uint64_t> transfer_sizes{4ull << 10, 64ull << 10, 1ull << 20, 16ull << 20, 256ull << 20};
+
+    // Where the *.comp.glsl.in templates are read from, the ones built into the binary if not set
+    std::optional<std::filesystem::path> template_directory;
+
+    bool has_mode(sweep_mode mode) const
+    {
+        return modes.contains(mode);
+    }
+    bool matches_device(std::size_t index, std::string_view name) const;
+    bool matches_configuration(const VkCooperativeMatrixPropertiesKHR& cmprops) const;
+};
+
+// A single number, the whole string has to be one (no sign, no trailing garbage) and fit 32 bits.
+// Throws std::runtime_error otherwise, for the command line as much as for the sweep file
+std::uint32_t parse_uint32(std::string_view str);
+// Comma separated numbers and ranges, "1..64*2" doubles from 1 up to 64, "0..256+32" goes in steps of 32.
+// Sorted and without duplicates
+std::vector<std::uint32_t> parse_uint_list(std::string_view list);
+// Comma separated byte counts, K/M/G suffixes allowed
+std::vector<std::uint64_t> parse_byte_sizes(std::string_view list);
+// Comma separated MxNxK
+std::vector<tile_shape> parse_shapes(std::string_view list);
+
+// Reads a JSON sweep file on top of 'spec', only the keys that are there change anything.
+// Lists can be given as arrays, as strings in the command line syntax, or for the
+// tuning lists as {"from": a, "to": b, "factor": f} / {"from": a, "to": b, "step": s}.
+// Throws std::runtime_error on anything it doesn't understand
+void load_sweep_spec(const std::filesystem::path& path, sweep_spec& spec);
+
+#endif /* ifndef SWEEP_SPEC */
@@ -0,0 +1,155 @@
+#include "timing_statistics.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // Linear interpolation between closest ranks, expects sorted input
+    double percentile(std::span<const double> sorted, double fraction)
+    {
+        if(sorted.empty())
+        {
+            return 0.0;
+        }
+        double rank = fraction*static_cast<double>(sorted.size() - 1);
+        auto lower = static_cast<std::size_t>(std::floor(rank));
+        auto upper = std::min(lower + 1, sorted.size() - 1);
+        double weight = rank - static_cast<double>(lower);
+        return sorted[lower]*(1.0 - weight) + sorted[upper]*weight;
+    }
+
+    // Partially sorts, so it takes a copy
+    double median_of(std::vector<double> values)
+    {
+        if(values.empty())
+        {
+            return 0.0;
+        }
+        auto mid = values.begin() + values.size()/2;
+        std::nth_element(values.begin(), mid, values.end());
+        if(values.size() % 2 == 1)
+        {
+            return *mid;
+        }
+        return 0.5*(*mid + *std::max_element(values.begin(), mid));
+    }
+}
+
+timing_statistics compute_timing_statistics(
+        std::span<const double> nanoseconds,
+        const statistics_settings& settings)
+{
+    timing_statistics stats;
+    if(nanoseconds.empty())
+    {
+        return stats;
+    }
+
+    std::vector<double> samples(nanoseconds.begin(), nanoseconds.end());
+    stats.raw_min = *std::min_element(samples.begin(), samples.end());
+    stats.raw_mean = std::accumulate(samples.begin(), samples.end(), 0.0)/static_cast<double>(samples.size());
+
+    // MAD outlier rejection, 1.4826 makes the MAD consistent with stddev for normal data.
+    // If more than half the samples are identical the MAD is 0 and everything is kept
+    if(settings.outlier_threshold > 0.0 && samples.size() > 2)
+    {
+        double median = median_of(samples);
+        std::vector<double> deviations(samples.size());
+        std::transform(samples.begin(), samples.end(), deviations.begin(),
+                [median](double x) { return std::abs(x - median); });
+        double sigma = 1.4826*median_of(deviations);
+        if(sigma > 0.0)
+        {
+            auto limit = settings.outlier_threshold*sigma;
+            auto last = std::remove_if(samples.begin(), samples.end(),
+                    [median, limit](double x) { return std::abs(x - median) > limit; });
+            stats.outliers = static_cast<std::size_t>(samples.end() - last);
+            samples.erase(last, samples.end());
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    const auto n = samples.size();
+    stats.count = n;
+    stats.min = samples.front();
+    stats.max = samples.back();
+    stats.mean = std::accumulate(samples.begin(), samples.end(), 0.0)/static_cast<double>(n);
+    stats.median = percentile(samples, 0.5);
+    stats.p5 = percentile(samples, 0.05);
+    stats.p95 = percentile(samples, 0.95);
+    stats.p99 = percentile(samples, 0.99);
+
+    if(n > 1)
+    {
+        double sum_sq = 0.0;
+        for(auto x : samples)
+        {
+            sum_sq += (x - stats.mean)*(x - stats.mean);
+        }
+        stats.stddev = std::sqrt(sum_sq/static_cast<double>(n - 1));
+    }
+    stats.cv = (stats.mean > 0.0) ? stats.stddev/stats.mean : 0.0;
+
+    // Percentile bootstrap of the median
+    stats.ci_low = stats.ci_high = stats.median;
+    if(n > 1 && settings.bootstrap_resamples > 0)
+    {
+        std::mt19937_64 rng(settings.bootstrap_seed);
+        std::uniform_int_distribution<std::size_t> pick(0, n - 1);
+        std::vector<double> resample(n);
+        std::vector<double> medians(settings.bootstrap_resamples);
+        for(auto& m : medians)
+        {
+            for(auto& x : resample)
+            {
+                x = samples[pick(rng)];
+            }
+            m = median_of(resample);
+        }
+        std::sort(medians.begin(), medians.end());
+        double alpha = 1.0 - settings.confidence;
+        stats.ci_low = percentile(medians, 0.5*alpha);
+        stats.ci_high = percentile(medians, 1.0 - 0.5*alpha);
+    }
+
+    return stats;
+}
+
+latency_histogram compute_latency_histogram(
+        std::span<const double> nanoseconds,
+        std::uint32_t buckets_per_octave)
+{
+    latency_histogram histogram;
+    if(nanoseconds.empty())
+    {
+        return histogram;
+    }
+    const double per_octave = std::max<std::uint32_t>(buckets_per_octave, 1);
+
+    // Anything below 1 ns is timer noise, it goes into the first bucket
+    auto [min_it, max_it] = std::minmax_element(nanoseconds.begin(), nanoseconds.end());
+    const double low = std::max(*min_it, 1.0);
+    const double high = std::max(*max_it, low);
+
+    // Edges on powers of 2^(1/buckets_per_octave), so runs with different ranges line up
+    const double first = std::floor(std::log2(low)*per_octave);
+    const auto buckets = static_cast<std::size_t>(std::floor(std::log2(high)*per_octave) - first) + 1;
+    histogram.edges.resize(buckets + 1);
+    for(std::size_t i = 0; i <= buckets; i++)
+    {
+        histogram.edges[i] = std::exp2((first + static_cast<double>(i))/per_octave);
+    }
+
+    histogram.counts.assign(buckets, 0);
+    for(auto x : nanoseconds)
+    {
+        double position = std::floor(std::log2(std::max(x, low))*per_octave) - first;
+        auto bucket = static_cast<std::size_t>(std::clamp(position, 0.0, static_cast<double>(buckets - 1)));
+        histogram.counts[bucket]++;
+    }
+    return histogram;
+}
@@ -0,0 +1,72 @@
+#ifndef TIMING_STATISTICS
+#define TIMING_STATISTICS
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Distribution of the per-dispatch durations of one benchmark, all times in ns
+struct timing_statistics
+{
+    // Samples left after outlier rejection / samples that were rejected
+    std::size_t count = 0;
+    std::size_t outliers = 0;
+
+    // Over every sample, before outlier rejection. This is what Min./Avg. always were
+    double raw_min = 0.0;
+    double raw_mean = 0.0;
+
+    // Everything from here on is after outlier rejection
+    double min = 0.0;
+    double max = 0.0;
+    double mean = 0.0;
+    double median = 0.0;
+    double p5 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double stddev = 0.0;
+    // stddev/mean
+    double cv = 0.0;
+
+    // Bootstrap confidence interval of the median
+    double ci_low = 0.0;
+    double ci_high = 0.0;
+
+    // Half the CI width relative to the median, this is what the repetition loop looks at
+    auto relative_ci_half_width() const -> double
+    {
+        return (median > 0.0) ? 0.5*(ci_high - ci_low)/median : 0.0;
+    }
+};
+
+struct statistics_settings
+{
+    // Samples further than this many (MAD based) standard deviations
+    // away from the median are thrown out, <= 0 disables the filter
+    double outlier_threshold = 3.5;
+    double confidence = 0.95;
+    std::uint32_t bootstrap_resamples = 1000;
+    // Fixed, so the same samples always give the same CI
+    std::uint64_t bootstrap_seed = 0x5eed;
+};
+
+timing_statistics compute_timing_statistics(
+        std::span<const double> nanoseconds,
+        const statistics_settings& settings = {});
+
+// Log spaced, latencies easily spread over a few orders of magnitude
+// and the long tail is the interesting part
+struct latency_histogram
+{
+    // Bucket i holds [edges[i], edges[i+1]), so there is one more edge than counts
+    std::vector<double> edges;
+    std::vector<std::size_t> counts;
+};
+
+// Nothing is rejected here, outliers are what a histogram is for
+latency_histogram compute_latency_histogram(
+        std::span<const double> nanoseconds,
+        std::uint32_t buckets_per_octave = 4);
+
+#endif /* ifndef TIMING_STATISTICS */
@@ -2,6 +2,7 @@
 #define VK_COMPONENT_TYPE_TO_STR
 #include <vulkan/vulkan.h>
 
+#include <cstddef>
 #include <string_view>
 
 constexpr std::string_view component_type_to_str(VkComponentTypeKHR type)
@@ -41,4 +42,34 @@ constexpr std::string_view component_type_to_glsl_type_str(VkComponentTypeKHR ty
         default: return "bad_type";
     }
 }
+constexpr bool component_type_is_float(VkComponentTypeKHR type)
+{
+    return (type == VK_COMPONENT_TYPE_FLOAT16_KHR) ||
+           (type == VK_COMPONENT_TYPE_FLOAT32_KHR) ||
+           (type == VK_COMPONENT_TYPE_FLOAT64_KHR);
+}
+// Size in bytes, 0 for anything unknown
+constexpr std::size_t component_type_size(VkComponentTypeKHR type)
+{
+    switch(type)
+    {
+        case VK_COMPONENT_TYPE_SINT8_KHR:
+        case VK_COMPONENT_TYPE_UINT8_KHR:
+            return 1;
+        case VK_COMPONENT_TYPE_FLOAT16_KHR:
+        case VK_COMPONENT_TYPE_SINT16_KHR:
+        case VK_COMPONENT_TYPE_UINT16_KHR:
+            return 2;
+        case VK_COMPONENT_TYPE_FLOAT32_KHR:
+        case VK_COMPONENT_TYPE_SINT32_KHR:
+        case VK_COMPONENT_TYPE_UINT32_KHR:
+            return 4;
+        case VK_COMPONENT_TYPE_FLOAT64_KHR:
+        case VK_COMPONENT_TYPE_SINT64_KHR:
+        case VK_COMPONENT_TYPE_UINT64_KHR:
+            return 8;
+        default:
+            return 0;
+    }
+}
 #endif /* ifndef VK_COMPONENT_TYPE_TO_STR */